@@ -0,0 +1,28 @@
+#!/bin/sh
+# Runs chisai-bench against a chisai managing a headless Xvfb
+#
+# Usage: misc/bench.sh [operations]
+# BENCH_DISPLAY picks the display Xvfb takes, :99 by default
+
+display=${BENCH_DISPLAY:-:99}
+socket=$(mktemp -u /tmp/chisai-bench.XXXXXX)
+
+Xvfb "$display" -screen 0 1920x1080x24 -nolisten tcp >/dev/null 2>&1 &
+xvfb=$!
+trap 'kill $chisai $xvfb 2>/dev/null; rm -f "$socket"' EXIT INT TERM
+
+# Give the server a moment to take the display
+for _ in 1 2 3 4 5 6 7 8 9 10; do
+    [ -e "/tmp/.X11-unix/X${display#:}" ] && break
+    sleep 0.1
+done
+
+DISPLAY=$display CHISAI_SOCKET=$socket ./chisai &
+chisai=$!
+
+for _ in 1 2 3 4 5 6 7 8 9 10; do
+    [ -S "$socket" ] && break
+    sleep 0.1
+done
+
+DISPLAY=$display CHISAI_SOCKET=$socket ./chisai-bench "$@"
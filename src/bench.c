@@ -0,0 +1,636 @@
+/* Chisai Bench - Load generator measuring how fast Chisai reacts */
+/* Imports */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <xcb/xcb.h>
+#include <xcb/xtest.h>
+
+/* Macros */
+#define CLEANMASK(mask) ((mask & ~0x80))
+
+/* How long to wait for Chisai before counting an operation as dropped */
+#define TIMEOUT_MS 1000
+
+/* Keysym of the key Chisai's MOD is on by default */
+#define XK_SUPER_L 0xffeb
+
+/*
+ * Struct: samples
+ * ---------------
+ * Latencies measured for one scenario
+ *
+ * name     - Name of the scenario
+ * latency  - Latency of every answered operation in nanoseconds
+ * length   - Number of answered operations
+ * dropped  - Operations Chisai never answered
+ * start    - When the scenario started
+ * end      - When the scenario ended
+ */
+struct samples {
+    const char *name;
+    uint64_t *latency;
+    uint32_t length;
+    uint32_t dropped;
+    uint64_t start, end;
+};
+
+/* Variables */
+static xcb_connection_t *connection;
+static xcb_screen_t *screen;
+static uint32_t count = 200;
+static int sock_fd = -1;
+
+/*
+ * Function: die
+ * -------------
+ * Returns the message and exists with an error
+ *
+ * fmt: Error message to return
+ * ...: Discard the rest of the arguments
+ *
+ * returns: nothing, just exists the file with the error
+ */
+static void
+die(char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * Function: now
+ * -------------
+ * Reads the monotonic clock
+ *
+ * returns: the time in nanoseconds
+ */
+static uint64_t
+now(void)
+{
+    struct timespec time;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000u + time.tv_nsec;
+}
+
+/*
+ * Function: begin
+ * ---------------
+ * Sets up the samples of a scenario
+ *
+ * samples: Samples to set up
+ * name:    Name of the scenario
+ *
+ * returns: nothing
+ */
+static void
+begin(struct samples *samples, const char *name)
+{
+    samples->name = name;
+    samples->length = 0;
+    samples->dropped = 0;
+
+    if (!(samples->latency = malloc(count * sizeof(uint64_t)))) {
+        die("chisai-bench: out of memory\n");
+    }
+
+    samples->start = now();
+}
+
+/*
+ * Function: compare
+ * -----------------
+ * Orders latencies for qsort
+ *
+ * returns: the usual negative, zero or positive
+ */
+static int
+compare(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * Function: report
+ * ----------------
+ * Prints the throughput and latency percentiles of a scenario and frees
+ * its samples
+ *
+ * samples: Samples of the scenario
+ *
+ * returns: nothing
+ */
+static void
+report(struct samples *samples)
+{
+    double seconds, p50 = 0, p99 = 0;
+
+    samples->end = now();
+    seconds = (samples->end - samples->start) / 1e9;
+
+    if (samples->length) {
+        qsort(samples->latency, samples->length, sizeof(uint64_t), compare);
+        p50 = samples->latency[samples->length / 2] / 1e3;
+        p99 = samples->latency[(samples->length * 99) / 100] / 1e3;
+    }
+
+    printf("%-12s %8u %8u %12.1f %10.1f %10.1f\n", samples->name,
+           samples->length, samples->dropped,
+           samples->length / seconds, p50, p99);
+
+    free(samples->latency);
+}
+
+/*
+ * Function: wait_for
+ * ------------------
+ * Waits until Chisai causes an event of the given type on a window,
+ * dropping every other event
+ *
+ * window: Window the event has to be about
+ * type:   Event type to wait for
+ *
+ * returns: true if it came before the timeout
+ */
+static bool
+wait_for(xcb_window_t window, uint8_t type)
+{
+    struct pollfd fd = { .fd = xcb_get_file_descriptor(connection), .events = POLLIN };
+    xcb_generic_event_t *event;
+    uint64_t deadline = now() + TIMEOUT_MS * 1000000ull;
+    xcb_window_t about;
+
+    while (now() < deadline) {
+        while ((event = xcb_poll_for_event(connection))) {
+            about = XCB_NONE;
+
+            switch (CLEANMASK(event->response_type)) {
+                case XCB_CONFIGURE_NOTIFY: {
+                    about = ((xcb_configure_notify_event_t *)event)->window;
+                } break;
+
+                case XCB_DESTROY_NOTIFY: {
+                    about = ((xcb_destroy_notify_event_t *)event)->window;
+                } break;
+
+                case XCB_FOCUS_IN: {
+                    about = ((xcb_focus_in_event_t *)event)->event;
+                } break;
+            }
+
+            if (CLEANMASK(event->response_type) == type && about == window) {
+                free(event);
+                return true;
+            }
+
+            free(event);
+        }
+
+        if (xcb_connection_has_error(connection)) {
+            die("chisai-bench: lost connection to x\n");
+        }
+
+        poll(&fd, 1, (deadline - now()) / 1000000 + 1);
+    }
+
+    return false;
+}
+
+/*
+ * Function: record
+ * ----------------
+ * Adds the outcome of one operation to the samples
+ *
+ * samples:  Samples of the scenario
+ * answered: Whether Chisai answered in time
+ * start:    When the operation was sent
+ *
+ * returns: nothing
+ */
+static void
+record(struct samples *samples, bool answered, uint64_t start)
+{
+    if (answered) {
+        samples->latency[samples->length++] = now() - start;
+    } else {
+        samples->dropped++;
+    }
+}
+
+/*
+ * Function: create_window
+ * -----------------------
+ * Creates a window listening for the events Chisai's answers cause
+ *
+ * x, y, width, height: Geometry of the window
+ *
+ * returns: the window
+ */
+static xcb_window_t
+create_window(int16_t x, int16_t y, uint16_t width, uint16_t height)
+{
+    xcb_window_t window = xcb_generate_id(connection);
+    uint32_t values[] = {
+        screen->black_pixel,
+        XCB_EVENT_MASK_STRUCTURE_NOTIFY | XCB_EVENT_MASK_FOCUS_CHANGE,
+    };
+
+    xcb_create_window(connection, XCB_COPY_FROM_PARENT, window, screen->root,
+                      x, y, width, height, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT,
+                      screen->root_visual, XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK, values);
+
+    return window;
+}
+
+/*
+ * Function: frame_of
+ * ------------------
+ * Finds the frame Chisai reparented a window into, and has the root report
+ * on it since frame moves never reach the window itself
+ *
+ * window: The window
+ *
+ * returns: the frame, or the window when it wasn't reparented
+ */
+static xcb_window_t
+frame_of(xcb_window_t window)
+{
+    xcb_query_tree_reply_t *tree;
+    xcb_window_t frame = window;
+    uint32_t values[] = { XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY };
+
+    tree = xcb_query_tree_reply(connection, xcb_query_tree(connection, window), NULL);
+
+    if (tree && tree->parent != screen->root) {
+        frame = tree->parent;
+        xcb_change_window_attributes(connection, screen->root, XCB_CW_EVENT_MASK, values);
+    }
+
+    free(tree);
+
+    return frame;
+}
+
+/*
+ * Function: send_command
+ * ----------------------
+ * Sends one command over the socket and waits for its status
+ *
+ * command: Command, newline terminated
+ *
+ * returns: true if Chisai answered ok
+ */
+static bool
+send_command(const char *command)
+{
+    struct pollfd fd = { .fd = sock_fd, .events = POLLIN };
+    char reply[256];
+    ssize_t length;
+    size_t received = 0;
+
+    if (write(sock_fd, command, strlen(command)) < 0) {
+        die("chisai-bench: failed to send command\n");
+    }
+
+    while (poll(&fd, 1, TIMEOUT_MS) > 0) {
+        if ((length = read(sock_fd, reply + received, sizeof(reply) - 1 - received)) <= 0) {
+            die("chisai-bench: chisai hung up\n");
+        }
+
+        received += length;
+
+        if (reply[received - 1] == '\n') {
+            reply[received] = '\0';
+            return !strcmp(reply, "ok\n");
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Function: bench_map
+ * -------------------
+ * Creates and maps windows one after another, timing how long Chisai
+ * takes to focus each of them, then destroys them, timing how long Chisai
+ * takes to destroy each frame
+ *
+ * returns: nothing
+ */
+static void
+bench_map(void)
+{
+    struct samples samples;
+    xcb_window_t *windows, frame;
+    uint64_t start;
+
+    if (!(windows = malloc(count * sizeof(xcb_window_t)))) {
+        die("chisai-bench: out of memory\n");
+    }
+
+    begin(&samples, "map");
+
+    for (uint32_t i = 0; i < count; i++) {
+        windows[i] = create_window(i % 400, i % 300, 200, 150);
+        xcb_map_window(connection, windows[i]);
+
+        start = now();
+        xcb_flush(connection);
+        record(&samples, wait_for(windows[i], XCB_FOCUS_IN), start);
+    }
+
+    report(&samples);
+    begin(&samples, "destroy");
+
+    /* Chisai answers a destroy by destroying the frame, which the root reports */
+    for (uint32_t i = 0; i < count; i++) {
+        frame = frame_of(windows[i]);
+
+        start = now();
+        xcb_destroy_window(connection, windows[i]);
+        xcb_flush(connection);
+        record(&samples, wait_for(frame, XCB_DESTROY_NOTIFY), start);
+    }
+
+    report(&samples);
+    free(windows);
+}
+
+/*
+ * Function: bench_drag
+ * --------------------
+ * Holds MOD and button 1 over a window and moves the pointer with XTEST,
+ * timing how long Chisai takes to move the window each step
+ *
+ * returns: nothing
+ */
+static void
+bench_drag(void)
+{
+    struct samples samples;
+    xcb_get_keyboard_mapping_reply_t *mapping;
+    const xcb_setup_t *setup = xcb_get_setup(connection);
+    xcb_keycode_t super = 0;
+    xcb_keysym_t *keysyms;
+    xcb_window_t window, frame;
+    uint64_t start;
+    int length;
+
+    mapping = xcb_get_keyboard_mapping_reply(connection,
+            xcb_get_keyboard_mapping(connection, setup->min_keycode,
+                setup->max_keycode - setup->min_keycode + 1), NULL);
+
+    if (!mapping) {
+        die("chisai-bench: failed to get the keyboard mapping\n");
+    }
+
+    keysyms = xcb_get_keyboard_mapping_keysyms(mapping);
+    length = xcb_get_keyboard_mapping_keysyms_length(mapping);
+
+    for (int i = 0; i < length && !super; i++) {
+        if (keysyms[i] == XK_SUPER_L) {
+            super = setup->min_keycode + i / mapping->keysyms_per_keycode;
+        }
+    }
+
+    free(mapping);
+
+    if (!super) {
+        die("chisai-bench: no Super_L key to drag with\n");
+    }
+
+    window = create_window(100, 100, 300, 200);
+    xcb_map_window(connection, window);
+    xcb_flush(connection);
+    wait_for(window, XCB_FOCUS_IN);
+    frame = frame_of(window);
+
+    xcb_test_fake_input(connection, XCB_MOTION_NOTIFY, 0, XCB_CURRENT_TIME,
+                        screen->root, 250, 200, 0);
+    xcb_test_fake_input(connection, XCB_KEY_PRESS, super, XCB_CURRENT_TIME,
+                        XCB_NONE, 0, 0, 0);
+    xcb_test_fake_input(connection, XCB_BUTTON_PRESS, 1, XCB_CURRENT_TIME,
+                        XCB_NONE, 0, 0, 0);
+    xcb_flush(connection);
+
+    begin(&samples, "drag");
+
+    /* Step in a square so every motion lands the window somewhere new */
+    for (uint32_t i = 0; i < count; i++) {
+        int16_t offset = (i % 100 + 1) * 2;
+
+        xcb_test_fake_input(connection, XCB_MOTION_NOTIFY, 0, XCB_CURRENT_TIME,
+                            screen->root, 250 + offset, 200 + (i / 100 % 2) * 50, 0);
+
+        start = now();
+        xcb_flush(connection);
+        record(&samples, wait_for(frame, XCB_CONFIGURE_NOTIFY), start);
+    }
+
+    report(&samples);
+
+    xcb_test_fake_input(connection, XCB_BUTTON_RELEASE, 1, XCB_CURRENT_TIME,
+                        XCB_NONE, 0, 0, 0);
+    xcb_test_fake_input(connection, XCB_KEY_RELEASE, super, XCB_CURRENT_TIME,
+                        XCB_NONE, 0, 0, 0);
+    xcb_destroy_window(connection, window);
+    xcb_flush(connection);
+}
+
+/*
+ * Function: bench_focus
+ * ---------------------
+ * Lays windows out in a grid and sweeps the pointer across them with
+ * sloppy focus on, timing how long Chisai takes to focus each one
+ *
+ * returns: nothing
+ */
+static void
+bench_focus(void)
+{
+    struct samples samples;
+    xcb_window_t windows[16];
+    uint16_t width = screen->width_in_pixels / 4;
+    uint16_t height = screen->height_in_pixels / 4;
+    uint64_t start;
+
+    if (!send_command("config sloppy_focus true\n")) {
+        die("chisai-bench: failed to turn on sloppy focus\n");
+    }
+
+    for (int i = 0; i < 16; i++) {
+        windows[i] = create_window((i % 4) * width, (i / 4) * height,
+                                   width - 20, height - 20);
+        xcb_map_window(connection, windows[i]);
+        xcb_flush(connection);
+        wait_for(windows[i], XCB_FOCUS_IN);
+    }
+
+    begin(&samples, "focus");
+
+    /* Skip to the next window every time so each motion changes focus */
+    for (uint32_t i = 0; i < count; i++) {
+        int w = (i * 5) % 16;
+
+        xcb_test_fake_input(connection, XCB_MOTION_NOTIFY, 0, XCB_CURRENT_TIME,
+                            screen->root, (w % 4) * width + width / 2,
+                            (w / 4) * height + height / 2, 0);
+
+        start = now();
+        xcb_flush(connection);
+        record(&samples, wait_for(windows[w], XCB_FOCUS_IN), start);
+    }
+
+    report(&samples);
+
+    for (int i = 0; i < 16; i++) {
+        xcb_destroy_window(connection, windows[i]);
+    }
+
+    xcb_flush(connection);
+    send_command("config sloppy_focus false\n");
+}
+
+/*
+ * Function: bench_ipc
+ * -------------------
+ * Floods one connection with commands, writing for as long as the socket
+ * takes them and only reading statuses once Chisai pushes back, timing how
+ * long each status takes
+ *
+ * returns: nothing
+ */
+static void
+bench_ipc(void)
+{
+    const char command[] = "config border_width 5\n";
+    const size_t command_length = sizeof(command) - 1;
+    struct pollfd fd = { .fd = sock_fd };
+    struct samples samples;
+    uint64_t *starts;
+    char reply[256], *end;
+    size_t written = 0, received = 0, line;
+    uint32_t answered = 0;
+    ssize_t length;
+
+    if (!(starts = malloc(count * sizeof(uint64_t)))) {
+        die("chisai-bench: out of memory\n");
+    }
+
+    begin(&samples, "ipc");
+
+    while (answered < count) {
+        fd.events = written < count * command_length ? POLLIN | POLLOUT : POLLIN;
+
+        if (poll(&fd, 1, TIMEOUT_MS) <= 0) {
+            break;
+        }
+
+        /* Writing goes first, replies pile up until the socket stops taking commands */
+        if (fd.revents & POLLOUT) {
+            if (!(written % command_length)) {
+                starts[written / command_length] = now();
+            }
+
+            length = send(sock_fd, command + written % command_length,
+                          command_length - written % command_length, MSG_DONTWAIT);
+
+            if (length < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                die("chisai-bench: failed to send command\n");
+            }
+
+            written += length > 0 ? length : 0;
+            continue;
+        }
+
+        if ((length = read(sock_fd, reply + received, sizeof(reply) - 1 - received)) <= 0) {
+            die("chisai-bench: chisai hung up\n");
+        }
+
+        received += length;
+
+        /* Statuses come back in the order the commands went out */
+        while ((end = memchr(reply, '\n', received))) {
+            line = end - reply + 1;
+            record(&samples, line == 3 && !memcmp(reply, "ok\n", 3), starts[answered++]);
+            memmove(reply, end + 1, received - line);
+            received -= line;
+        }
+
+        if (received == sizeof(reply) - 1) {
+            die("chisai-bench: reply too long\n");
+        }
+    }
+
+    samples.dropped += count - answered;
+    report(&samples);
+    free(starts);
+}
+
+/*
+ * Function: main
+ * --------------
+ * Runs every scenario against the Chisai on $DISPLAY and $CHISAI_SOCKET
+ *
+ * argc: number of arguments
+ * argv: the arguments, optionally the number of operations per scenario
+ *
+ * returns: error if Chisai can't be reached
+ */
+int
+main(int argc, char *argv[])
+{
+    struct sockaddr_un sock_address = { .sun_family = AF_UNIX };
+    const char *sock_path;
+
+    if (argc > 1 && !(count = strtoul(argv[1], NULL, 10))) {
+        die("usage: %s [operations]\n", argv[0]);
+    }
+
+    if (xcb_connection_has_error(connection = xcb_connect(NULL, NULL))) {
+        die("%s: failed to connect to x\n", argv[0]);
+    }
+
+    screen = xcb_setup_roots_iterator(xcb_get_setup(connection)).data;
+
+    if (!(sock_path = getenv("CHISAI_SOCKET"))) {
+        sock_path = "/tmp/chisai.sock";
+    }
+
+    strncpy(sock_address.sun_path, sock_path, sizeof(sock_address.sun_path) - 1);
+
+    if ((sock_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+        || connect(sock_fd, (struct sockaddr *)&sock_address, sizeof(sock_address)) < 0) {
+        die("%s: failed to connect to socket\n", argv[0]);
+    }
+
+    printf("%-12s %8s %8s %12s %10s %10s\n", "scenario", "ops", "dropped",
+           "ops/s", "p50 (us)", "p99 (us)");
+
+    bench_map();
+    bench_drag();
+    bench_focus();
+    bench_ipc();
+
+    close(sock_fd);
+    xcb_disconnect(connection);
+
+    return EXIT_SUCCESS;
+}
@@ -1,24 +1,81 @@
 /* Includes */
+#define _POSIX_C_SOURCE 200809L
+
 #include <err.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <xcb/xcb.h>
 
 #include "config.h"
+#include "fake.h"
 #include "types.h"
 
 /* Macros */
 #define MAX(a, b) ((a > b) ? (a) : (b))
+#define MIN(a, b) ((a < b) ? (a) : (b))
 #define CLEANMASK(mask) ((mask & ~0x80))
+#define KEYMASK(mask) ((mask) & (SHIFT | CTRL | ALT | XCB_MOD_MASK_3 | SUPER | XCB_MOD_MASK_5))
+#define LENGTH(array) (sizeof(array) / sizeof(array[0]))
+
+/* Table sizing, capacity must stay a power of two */
+#define TABLE_MIN_CAPACITY 64
+
+/* Slot i of a table and the window keying it, whatever the table holds */
+#define SLOT(table, i) ((char*)(table)->slots + (size_t)(i) * (table)->size)
+#define SLOT_KEY(table, i) (*(xcb_window_t*)(SLOT(table, i) + (table)->key))
+
+/* Deepest visual frames are made for, deeper clients get a frame at the root depth */
+#define MAX_DEPTH 32
+
+/* Room a command needs in the output of its peer before it runs, the longest replies fit */
+#define PEER_RESERVE BUFSIZ
+
+/* Border width of a client nobody told us about yet */
+#define BORDER_UNKNOWN UINT16_MAX
+
+/* Ready file descriptors handled per wakeup */
+#define MAX_EVENTS 32
+
+/* Histograms past the X event types, for what isn't an X event */
+#define STAT_COMMAND 128
+#define STAT_FRAME   129
+#define STAT_LOOP    130
+#define STAT_FLUSH   131
+#define STAT_FOCUS   132
+#define STAT_SLOTS   133
+
+/* Recorded session files, every record is a header then length bytes */
+#define RECORD_MAGIC "CHISAIR2"
+enum {
+    RECORD_EVENT, RECORD_COMMAND, RECORD_FRAME, RECORD_FLUSH, RECORD_FOCUS,
+    RECORD_SETUP, RECORD_KEYMAP, RECORD_ADOPT, RECORD_DEPTH
+};
+
+/* Events the trace keeps, must be a power of two */
+#define TRACE_SIZE 65536
+
+/* Windows the microbenchmarks spread their events over */
+#define MICROBENCH_WINDOWS 256
+#define MICROBENCH_ID_BASE 0x00400000
+
+/* Windows the pointer crosses per wakeup in the enter sweep */
+#define MICROBENCH_SWEEP 16
 
 enum { INACTIVE, ACTIVE };
 
@@ -31,12 +88,98 @@ enum { INACTIVE, ACTIVE };
 
 /* Socket Variables */
 static int sock_fd;
-static int client_fd;
 static const char *sock_path;
+static struct peer **peers;
+static int peers_capacity;
+static struct peer *spare_peer;
+
+/* Loop Variables */
+static int epoll_fd;
+
+/* Config Variables */
+static int config_fd = -1;
+static char config_file[PATH_MAX];
+static const char *config_name;
+
+/* Stats Variables */
+static struct histogram histograms[STAT_SLOTS];
+static struct traffic traffic[STAT_SLOTS];
+static int charged = STAT_LOOP;
+static uint64_t reply_start;
+static struct peer *requester;
+
+/* Names of what gets timed, by X event type or STAT_ slot */
+static const char *stat_names[STAT_SLOTS] = {
+    [XCB_CREATE_NOTIFY]    = "create_notify",
+    [XCB_DESTROY_NOTIFY]   = "destroy_notify",
+    [XCB_MAP_NOTIFY]       = "map_notify",
+    [XCB_UNMAP_NOTIFY]     = "unmap_notify",
+    [XCB_ENTER_NOTIFY]     = "enter_notify",
+    [XCB_BUTTON_PRESS]     = "button_press",
+    [XCB_MOTION_NOTIFY]    = "motion_notify",
+    [XCB_BUTTON_RELEASE]   = "button_release",
+    [XCB_CONFIGURE_NOTIFY] = "configure_notify",
+    [XCB_KEY_PRESS]        = "key_press",
+    [XCB_MAPPING_NOTIFY]   = "mapping_notify",
+    [STAT_COMMAND]         = "command",
+    [STAT_FRAME]           = "drag_frame",
+    [STAT_LOOP]            = "loop",
+    [STAT_FLUSH]           = "flush",
+    [STAT_FOCUS]           = "focus_delay",
+};
+
+/* Trace Variables */
+static struct trace_event trace[TRACE_SIZE];
+static uint64_t trace_length;
+static uint32_t unflushed;
+
+/* Record Variables */
+static FILE *recording;
+static uint64_t recording_start;
+
+/* Microbenchmark Variables */
+static uint64_t microbench_start;
+static struct fake_counts microbench_counts;
+
+/* Key Variables */
+static xcb_keysym_t keysyms[256];
+static xcb_keycode_t min_keycode = 8, max_keycode = 255;
+
+/* Drag Variables */
+static int frame_fd;
+static struct drag drag;
+
+/* Focus Variables */
+static int focus_fd;
+static struct client *focus_target;
+static uint64_t focus_deadline;
+static bool focus_armed;
+static xcb_window_t adopt_focus;
+
+/* Frame Variables */
+static struct insets insets;
+static const struct insets no_insets;
+static struct frame_visual frame_visuals[MAX_DEPTH + 1];
+static bool borders_stale;
+
+/* Stacking Variables */
+static struct client *stack_bottom, *stack_top;
+static bool stack_known = true;
+static uint32_t restacks_pending;
+static uint32_t restack_sequence;
+static uint32_t newest_sequence;
 
 /* Group Variables */
 static uint16_t focused_workspace = 1;
-static struct list *window_list = NULL;
+static struct workspace *workspaces;
+static uint16_t workspaces_length;
+static struct client_table clients = {
+    .table = {.size = sizeof(struct client_slot), .key = offsetof(struct client_slot, window)}
+};
+static struct client_pool client_pool;
+static struct table unmanaged = {
+    .size = sizeof(struct unmanaged), .key = offsetof(struct unmanaged, window)
+};
 
 /* XCB Variables */
 static xcb_connection_t *connection;
@@ -44,9 +187,21 @@ static xcb_screen_t *screen;
 static struct client *focused_window;
 static struct conf config;
 
-/* List Functions */
-static struct node* add_node(struct list *list);
-static void delete_node(struct list *list, struct node *node);
+/* Table Functions */
+static bool grow_table(struct table *table);
+static void* probe_slot(const struct table *table, xcb_window_t window);
+static void* insert_slot(struct table *table, xcb_window_t window);
+static void* lookup_slot(const struct table *table, xcb_window_t window);
+static void remove_slot(struct table *table, xcb_window_t window);
+static struct client* add_client(struct client_table *table, xcb_window_t window);
+static struct client* lookup_client(const struct client_table *table, xcb_window_t window);
+static void delete_client(struct client_table *table, xcb_window_t window);
+
+/* Pool Functions */
+static struct client* alloc_client(struct client_pool *pool);
+static void free_client(struct client_pool *pool, struct client *client);
+static void free_pool(struct client_pool *pool);
+static void show_memory(void);
 
 /* X Event Functions */
 static void new_window(xcb_generic_event_t *event);
@@ -55,9 +210,39 @@ static void map_window(xcb_generic_event_t *event);
 static void unmap_window(xcb_generic_event_t *event);
 static void enter_window(xcb_generic_event_t *event);
 static void configure_window(xcb_generic_event_t *event);
-static void button_press(xcb_generic_event_t *event, struct client *client, xcb_get_geometry_reply_t *geometry, uint32_t *values);
-static void mouse_motion(struct client *client, xcb_get_geometry_reply_t *geometry, uint32_t *values);
-static void button_release(struct client *client);
+static void button_press(xcb_generic_event_t *event);
+static void mouse_motion(xcb_generic_event_t *event);
+static void button_release(xcb_generic_event_t *event);
+static void key_press(xcb_generic_event_t *event);
+static void mapping_notify(xcb_generic_event_t *event);
+
+/* Key Functions */
+static void grab_keys(void);
+
+/* Workspace Functions */
+static struct workspace* get_workspace(uint16_t number);
+static bool attach_client(struct client *client, uint16_t number);
+static void detach_client(struct client *client);
+static const char* switch_workspace(const union value *value);
+
+/* Stacking Functions */
+static void stack_client(struct client *client, struct client *below);
+static void unstack_client(struct client *client);
+static void raise_window(struct client *client);
+static void restack_notify(struct client *client, xcb_window_t sibling, uint32_t sequence);
+static void flush_stacking(void);
+static int flush_batch(void);
+
+/* Drag Functions */
+static void pace_drag(bool paced);
+static void drag_frame(void);
+static void apply_drag(void);
+
+/* Focus Functions */
+static void schedule_focus(struct client *client);
+static void arm_focus(uint64_t delay);
+static void settle_focus(void);
+static void flush_focus(void);
 
 /* Wrapper Functions */
 static void raise_current_window(void);
@@ -66,90 +251,490 @@ static void minimize_current_window(void);
 static void toggle_maximize_window(void);
 
 /* X Helper Functions */
-static struct client* setup_window(xcb_window_t window);
-static bool get_geometry(const xcb_drawable_t *window, int16_t *x, int16_t *y, uint16_t *height, uint16_t *width, uint8_t *depth);
+static struct client* setup_window(xcb_window_t window, int16_t x, int16_t y, uint16_t width, uint16_t height, uint16_t border_width, uint8_t depth);
+static bool frame_client(struct client *client, uint8_t depth);
+static bool resolve_depth(struct client *client);
+static const struct frame_visual* get_frame_visual(uint8_t depth);
+static void update_insets(void);
 static void set_borders(struct client *client, int mode);
-static void resize_window(xcb_drawable_t window, const uint16_t width, const uint16_t height);
+static void repaint_borders(void);
+static void configure_client(struct client *client, int16_t x, int16_t y, uint16_t width, uint16_t height);
+static void configure_border(struct client *client, uint16_t width);
+static void notify_client(struct client *client);
+static uint16_t stale_fields(uint32_t sequence, uint32_t newest, uint16_t *pending);
 static void minimize_window(struct client *client);
 static void maximize_window(struct client *client);
 static void unmax_window(struct client *client);
-static void move_resize_window(xcb_drawable_t window, const uint16_t x, const uint16_t y, const uint16_t width, const uint16_t height);
 static struct client* find_client(const xcb_drawable_t *window);
 static void forget_window(xcb_window_t window);
 
 /* Wrapper Call Functions */
 /* TODO: Rewrite maximize and minimize to this as well since this is controlled by maikuro */
-static void raise_window(xcb_drawable_t window);
 static void close_window(xcb_drawable_t window);
 
 
+/* Stats Functions */
+static uint64_t now(void);
+static uint64_t start_timing(void);
+static void record_timing(int slot, uint64_t start, uint32_t requests);
+static void show_stats(void);
+static const char* stat_name(int slot);
+static void reset_stats(void);
+static void count_request(void);
+static int count_flush(xcb_connection_t *connection);
+static void begin_reply(void);
+static void* end_reply(void *reply);
+static void show_traffic(void);
+static void print_traffic(void);
+static const char* dump_trace(const union value *value);
+
+/* Setting Functions */
+static const char* set_border_width(const union value *value);
+static const char* set_border_side(const union value *value);
+static const char* set_focus_color(const union value *value);
+static const char* set_unfocus_color(const union value *value);
+static const char* set_focus_delay(const union value *value);
+static const char* set_refresh_rate(const union value *value);
+static const char* set_sloppy_focus(const union value *value);
+static const char* set_workspaces(const union value *value);
+static const char* set_stats(const union value *value);
+static const char* set_trace(const union value *value);
+
 /* Helper Functions */
 static uint32_t get_color(const char *hex);
+static int compare_command(const void *name, const void *command);
+static const char* parse_value(const struct command *command, const char *word, union value *value);
 
 /* Main Functions */
 static void cleanup(void);
 static int socket_deploy(void);
 static int x_deploy(void);
+static int timer_deploy(void);
 static void load_defaults(void);
 static void load_config(void);
-static void subscribe(struct client *client);
+static bool config_path(char *path, size_t size, const char *name);
+static void read_config(void);
+static void reload_config(void);
+static void autostart(void);
+static void adopt_windows(void);
+static void adopt_window(const struct record_adopt *adopt);
 static void focus(struct client *client, int mode);
+static int loop_deploy(void);
+static int watch_fd(int fd);
+static void accept_peers(void);
+static void read_peer(struct peer *peer);
+static void serve_peer(struct peer *peer);
+static bool write_peer(struct peer *peer);
+static void reply(struct peer *peer, const char *fmt, ...);
+static void close_peer(struct peer *peer);
+static const char* run_command(char *message);
+static void handle_events(void);
+static void handle_event(xcb_generic_event_t *event);
+static void dispatch_event(xcb_generic_event_t *event);
+static const char* execute_command(char *message);
+static void run_frame(void);
+static void run_focus(void);
 static void events_loop(void);
 
+/* Record Functions */
+static int record_deploy(const char *path);
+static void record_input(uint8_t kind, const void *data, uint16_t length);
+static void record_keymap(void);
+static void replay(const char *path);
+static bool read_record(FILE *file, uint8_t *kind, uint16_t *length, uint64_t *time);
+static uint8_t replayed_depth(const struct record_depth *depths, size_t length, xcb_window_t window);
+
+/* Microbenchmark Functions */
+static void microbench(uint32_t count);
+static void begin_microbench(void);
+static void end_microbench(const char *name, uint32_t ops);
+
+/* Commands - Keep sorted by name, they are looked up with a binary search */
+static const struct command commands[] = {
+    { "close",               VALUE_NONE, 0, 0,     close_current_window,    NULL },
+    { "config border_focus", VALUE_COLOR, 0, 0,    NULL,                    set_focus_color },
+    { "config border_side",  VALUE_SIDE, 0, 0,     NULL,                    set_border_side },
+    { "config border_unfocus", VALUE_COLOR, 0, 0,  NULL,                    set_unfocus_color },
+    { "config border_width", VALUE_INT,  0, 127,   NULL,                    set_border_width },
+    { "config focus_delay",  VALUE_INT,  0, 1000,  NULL,                    set_focus_delay },
+    { "config refresh_rate", VALUE_INT,  1, 1000,  NULL,                    set_refresh_rate },
+    { "config sloppy_focus", VALUE_BOOL, 0, 0,     NULL,                    set_sloppy_focus },
+    { "config stats",        VALUE_BOOL, 0, 0,     NULL,                    set_stats },
+    { "config trace",        VALUE_BOOL, 0, 0,     NULL,                    set_trace },
+    { "config workspace_number", VALUE_INT, 1, UINT16_MAX, NULL,            set_workspaces },
+    { "maximize",            VALUE_NONE, 0, 0,     toggle_maximize_window,  NULL },
+    { "memory",              VALUE_NONE, 0, 0,     show_memory,             NULL },
+    { "minimize",            VALUE_NONE, 0, 0,     minimize_current_window, NULL },
+    { "stats",               VALUE_NONE, 0, 0,     show_stats,              NULL },
+    { "stats_reset",         VALUE_NONE, 0, 0,     reset_stats,             NULL },
+    { "trace dump",          VALUE_STRING, 0, 0,   NULL,                    dump_trace },
+    { "traffic",             VALUE_NONE, 0, 0,     show_traffic,            NULL },
+    { "workspace",           VALUE_INT,  1, UINT16_MAX, NULL,               switch_workspace },
+};
+
+/* Keys - Set in config.h, run straight through the command table */
+static const struct key keys[] = { KEYS };
+
+/* Names accepted for border sides, indexed by enum position */
+static const char *sides[] = {
+    [TOP] = "top", [BOTTOM] = "bottom", [RIGHT] = "right", [LEFT] = "left", [ALL] = "all",
+};
+
+/* Values last applied from the config file, by command index, so a reload only touches what changed */
+static char *config_values[LENGTH(commands)];
+
+
+/*
+ * Accounting - Every request, reply and flush below is charged to whatever
+ * is being handled. Requests added to chisai need to be listed here and in
+ * struct backend too.
+ */
+#define COUNT_REQUEST(call) (count_request(), call)
+#define COUNT_REPLY(call)   (begin_reply(), end_reply(call))
+
+#define xcb_change_save_set(...)                  COUNT_REQUEST(backend->change_save_set(__VA_ARGS__))
+#define xcb_change_window_attributes(...)         COUNT_REQUEST(backend->change_window_attributes(__VA_ARGS__))
+#define xcb_change_window_attributes_checked(...) COUNT_REQUEST(backend->change_window_attributes_checked(__VA_ARGS__))
+#define xcb_clear_area(...)                       COUNT_REQUEST(backend->clear_area(__VA_ARGS__))
+#define xcb_configure_window(...)                 COUNT_REQUEST(backend->configure_window(__VA_ARGS__))
+#define xcb_create_colormap(...)                  COUNT_REQUEST(backend->create_colormap(__VA_ARGS__))
+#define xcb_create_window(...)                    COUNT_REQUEST(backend->create_window(__VA_ARGS__))
+#define xcb_destroy_window(...)                   COUNT_REQUEST(backend->destroy_window(__VA_ARGS__))
+#define xcb_get_geometry(...)                     COUNT_REQUEST(backend->get_geometry(__VA_ARGS__))
+#define xcb_get_input_focus(...)                  COUNT_REQUEST(backend->get_input_focus(__VA_ARGS__))
+#define xcb_get_keyboard_mapping(...)             COUNT_REQUEST(backend->get_keyboard_mapping(__VA_ARGS__))
+#define xcb_get_window_attributes(...)            COUNT_REQUEST(backend->get_window_attributes(__VA_ARGS__))
+#define xcb_grab_button(...)                      COUNT_REQUEST(backend->grab_button(__VA_ARGS__))
+#define xcb_grab_key(...)                         COUNT_REQUEST(backend->grab_key(__VA_ARGS__))
+#define xcb_grab_pointer(...)                     COUNT_REQUEST(backend->grab_pointer(__VA_ARGS__))
+#define xcb_kill_client(...)                      COUNT_REQUEST(backend->kill_client(__VA_ARGS__))
+#define xcb_map_window(...)                       COUNT_REQUEST(backend->map_window(__VA_ARGS__))
+#define xcb_query_tree(...)                       COUNT_REQUEST(backend->query_tree(__VA_ARGS__))
+#define xcb_reparent_window(...)                  COUNT_REQUEST(backend->reparent_window(__VA_ARGS__))
+#define xcb_send_event(...)                       COUNT_REQUEST(backend->send_event(__VA_ARGS__))
+#define xcb_set_input_focus(...)                  COUNT_REQUEST(backend->set_input_focus(__VA_ARGS__))
+#define xcb_ungrab_key(...)                       COUNT_REQUEST(backend->ungrab_key(__VA_ARGS__))
+#define xcb_ungrab_pointer(...)                   COUNT_REQUEST(backend->ungrab_pointer(__VA_ARGS__))
+#define xcb_unmap_window(...)                     COUNT_REQUEST(backend->unmap_window(__VA_ARGS__))
+#define xcb_warp_pointer(...)                     COUNT_REQUEST(backend->warp_pointer(__VA_ARGS__))
+
+#define xcb_get_geometry_reply(...)          COUNT_REPLY(backend->get_geometry_reply(__VA_ARGS__))
+#define xcb_get_input_focus_reply(...)       COUNT_REPLY(backend->get_input_focus_reply(__VA_ARGS__))
+#define xcb_get_keyboard_mapping_reply(...)  COUNT_REPLY(backend->get_keyboard_mapping_reply(__VA_ARGS__))
+#define xcb_get_window_attributes_reply(...) COUNT_REPLY(backend->get_window_attributes_reply(__VA_ARGS__))
+#define xcb_query_tree_reply(...)            COUNT_REPLY(backend->query_tree_reply(__VA_ARGS__))
+
+#define xcb_flush(connection) count_flush(connection)
+
+/* Not requests, these only go through the backend */
+#define xcb_generate_id(...)          backend->generate_id(__VA_ARGS__)
+#define xcb_poll_for_event(...)       backend->poll_for_event(__VA_ARGS__)
+#define xcb_poll_for_queued_event(...) backend->poll_for_queued_event(__VA_ARGS__)
+#define xcb_discard_reply(...)        backend->discard_reply(__VA_ARGS__)
+#define xcb_connection_has_error(...) backend->connection_has_error(__VA_ARGS__)
+
+/* Backend - The real connection, -b swaps it for the fake in fake.c */
+static const struct backend xcb_backend = {
+    .change_save_set                  = xcb_change_save_set,
+    .change_window_attributes         = xcb_change_window_attributes,
+    .change_window_attributes_checked = xcb_change_window_attributes_checked,
+    .clear_area                       = xcb_clear_area,
+    .configure_window                 = xcb_configure_window,
+    .create_colormap                  = xcb_create_colormap,
+    .create_window                    = xcb_create_window,
+    .destroy_window                   = xcb_destroy_window,
+    .get_geometry                     = xcb_get_geometry,
+    .get_input_focus                  = xcb_get_input_focus,
+    .get_keyboard_mapping             = xcb_get_keyboard_mapping,
+    .get_window_attributes            = xcb_get_window_attributes,
+    .grab_button                      = xcb_grab_button,
+    .grab_key                         = xcb_grab_key,
+    .grab_pointer                     = xcb_grab_pointer,
+    .kill_client                      = xcb_kill_client,
+    .map_window                       = xcb_map_window,
+    .query_tree                       = xcb_query_tree,
+    .reparent_window                  = xcb_reparent_window,
+    .send_event                       = xcb_send_event,
+    .set_input_focus                  = xcb_set_input_focus,
+    .ungrab_key                       = xcb_ungrab_key,
+    .ungrab_pointer                   = xcb_ungrab_pointer,
+    .unmap_window                     = xcb_unmap_window,
+    .warp_pointer                     = xcb_warp_pointer,
+    .get_geometry_reply               = xcb_get_geometry_reply,
+    .get_input_focus_reply            = xcb_get_input_focus_reply,
+    .get_keyboard_mapping_reply       = xcb_get_keyboard_mapping_reply,
+    .get_window_attributes_reply      = xcb_get_window_attributes_reply,
+    .query_tree_reply                 = xcb_query_tree_reply,
+    .flush                            = xcb_flush,
+    .generate_id                      = xcb_generate_id,
+    .poll_for_event                   = xcb_poll_for_event,
+    .poll_for_queued_event            = xcb_poll_for_queued_event,
+    .discard_reply                    = xcb_discard_reply,
+    .connection_has_error             = xcb_connection_has_error,
+};
+
+static const struct backend *backend = &xcb_backend;
+
+static bool
+grow_table(struct table *table)
+{
+    struct table grown = *table;
+    char *slot;
+
+    grown.capacity = table->capacity ? table->capacity * 2 : TABLE_MIN_CAPACITY;
+    grown.slots = calloc(grown.capacity, table->size);
+
+    if (!grown.slots) {
+        return false;
+    }
+
+    /* Rehash every slot into the new ones, frames included */
+    for (uint32_t j = 0; j < table->capacity; j++) {
+        if (!SLOT_KEY(table, j)) {
+            continue;
+        }
+
+        slot = probe_slot(&grown, SLOT_KEY(table, j));
+        memcpy(slot, SLOT(table, j), table->size);
+    }
+
+    free(table->slots);
+    *table = grown;
+
+    return true;
+}
+
+
+static void*
+probe_slot(const struct table *table, xcb_window_t window)
+{
+    uint32_t i = WINDOW_HASH(window, table->capacity);
+
+    /* Stops on the window or on the empty slot ending its probe chain */
+    while (SLOT_KEY(table, i) && SLOT_KEY(table, i) != window) {
+        i = (i + 1) & (table->capacity - 1);
+    }
+
+    return SLOT(table, i);
+}
+
+
+static void*
+insert_slot(struct table *table, xcb_window_t window)
+{
+    char *slot;
+
+    /* Keep the load factor under 3/4 so probes stay short */
+    if ((table->length + 1) * 4 > table->capacity * 3 && !grow_table(table)) {
+        return NULL;
+    }
+
+    slot = probe_slot(table, window);
+
+    if (!*(xcb_window_t*)(slot + table->key)) {
+        *(xcb_window_t*)(slot + table->key) = window;
+        table->length++;
+    }
+
+    return slot;
+}
+
+
+static void*
+lookup_slot(const struct table *table, xcb_window_t window)
+{
+    char *slot;
+
+    if (!table->length) {
+        return NULL;
+    }
+
+    slot = probe_slot(table, window);
+
+    return *(xcb_window_t*)(slot + table->key) ? slot : NULL;
+}
+
+
+static void
+remove_slot(struct table *table, xcb_window_t window)
+{
+    uint32_t i, j, home;
+    char *slot;
+
+    if (!(slot = lookup_slot(table, window))) {
+        return;
+    }
+
+    /* Shift the rest of the probe chain back so no tombstones are needed */
+    i = (slot - (char*)table->slots) / table->size;
+    SLOT_KEY(table, i) = XCB_NONE;
+
+    for (j = (i + 1) & (table->capacity - 1); SLOT_KEY(table, j);
+         j = (j + 1) & (table->capacity - 1)) {
+        home = WINDOW_HASH(SLOT_KEY(table, j), table->capacity);
 
-static struct node*
-add_node(struct list *list)
+        if (((j - home) & (table->capacity - 1)) >= ((j - i) & (table->capacity - 1))) {
+            memcpy(SLOT(table, i), SLOT(table, j), table->size);
+            SLOT_KEY(table, j) = XCB_NONE;
+            i = j;
+        }
+    }
+
+    table->length--;
+}
+
+
+static struct client*
+add_client(struct client_table *table, xcb_window_t window)
 {
-    struct node *node;
+    struct client_slot *slot;
+    struct client *client;
 
-    node = (struct node *) malloc(sizeof(struct node));
+    if ((client = lookup_client(table, window))) {
+        return client;
+    }
+
+    client = alloc_client(&client_pool);
+
+    if (!client) {
+        return NULL;
+    }
 
-    if (!node) {
+    if (!(slot = insert_slot(&table->table, window))) {
+        free_client(&client_pool, client);
         return NULL;
     }
 
-    if (!list) {
-        node->next = NULL;
+    slot->client = client;
+    client->window = window;
+    client->previous = table->tail;
+
+    if (table->tail) {
+        table->tail->next = client;
     } else {
-        node->next = list->head;
+        table->head = client;
     }
 
-    list->head = node;
-    list->length++;
+    table->tail = client;
 
-    return node;
+    return client;
 }
 
 
+static struct client*
+lookup_client(const struct client_table *table, xcb_window_t window)
+{
+    struct client_slot *slot = lookup_slot(&table->table, window);
+
+    return slot ? slot->client : NULL;
+}
+
 
 static void
-delete_node(struct list *list, struct node *node)
+delete_client(struct client_table *table, xcb_window_t window)
 {
-    struct node *previous = NULL;
-    struct node *current  = list->head;
-    struct node *next     = NULL;
+    struct client *client;
 
-    if (!list || !node) {
+    /* Either of the client's windows finds it, both slots go */
+    if (!(client = lookup_client(table, window))) {
         return;
-    } else if (node == list->head) {
-        struct node *new_head = list->head->next;
-        free(list->head);
-        list->head = new_head;
+    }
+
+    remove_slot(&table->table, client->window);
+
+    if (client->frame) {
+        remove_slot(&table->table, client->frame);
+    }
+
+    if (client->previous) {
+        client->previous->next = client->next;
     } else {
-        while (current != node) {
-            previous = current;
-            current = current->next;
+        table->head = client->next;
+    }
+
+    if (client->next) {
+        client->next->previous = client->previous;
+    } else {
+        table->tail = client->previous;
+    }
+
+    free_client(&client_pool, client);
+}
+
+
+static struct client*
+alloc_client(struct client_pool *pool)
+{
+    struct client_slab *slab;
+    struct client *client;
+
+    /* Only carve out a new slab once every freed client is back in use */
+    if (!pool->free) {
+        slab = aligned_alloc(_Alignof(struct client_slab), sizeof(struct client_slab));
+
+        if (!slab) {
+            return NULL;
         }
-        if (!current) {
-            return;
-        } else {
-            next = current->next;
-            free(current);
-            previous->next = next;
+
+        slab->next = pool->slabs;
+        pool->slabs = slab;
+        pool->count++;
+
+        for (int i = LENGTH(slab->clients) - 1; i >= 0; i--) {
+            slab->clients[i].next = pool->free;
+            pool->free = &slab->clients[i];
         }
     }
 
-    list->length--;
+    client = pool->free;
+    pool->free = client->next;
+    memset(client, 0, sizeof(struct client));
+
+    pool->live++;
+    pool->peak = MAX(pool->peak, pool->live);
+
+    return client;
+}
+
+
+static void
+free_client(struct client_pool *pool, struct client *client)
+{
+    client->next = pool->free;
+    pool->free = client;
+    pool->live--;
+}
+
+
+static void
+free_pool(struct client_pool *pool)
+{
+    struct client_slab *next;
+
+    for (struct client_slab *slab = pool->slabs; slab; slab = next) {
+        next = slab->next;
+        free(slab);
+    }
+
+    memset(pool, 0, sizeof(struct client_pool));
+}
+
+
+static void
+show_memory(void)
+{
+    if (!requester) {
+        return;
+    }
+
+    reply(requester, "> clients live %u peak %u slabs %u bytes %zu\n",
+          client_pool.live, client_pool.peak, client_pool.count,
+          client_pool.count * sizeof(struct client_slab));
+    reply(requester, "> table capacity %u bytes %zu\n",
+          clients.table.capacity, clients.table.capacity * sizeof(struct client_slot));
+    reply(requester, "> unmanaged %u capacity %u bytes %zu\n",
+          unmanaged.length, unmanaged.capacity,
+          unmanaged.capacity * sizeof(struct unmanaged));
 }
 
 
@@ -158,18 +743,27 @@ new_window(xcb_generic_event_t *event)
 {
     xcb_create_notify_event_t *e;
     e = (xcb_create_notify_event_t *)event;
-    struct client *client;
+    struct unmanaged *entry;
 
-    client = setup_window(e->window);
-
-    if (!client) {
+    /* Our own frames show up here too, and nothing else is ever created in them */
+    if (e->parent != screen->root || find_client(&e->window)) {
         return;
     }
 
-    if (!e->override_redirect) {
-        subscribe(client);
-        focus(client, ACTIVE);
+    /* Menus and tooltips are never managed, so don't spend a client on them */
+    if (e->override_redirect) {
+        if ((entry = insert_slot(&unmanaged, e->window))) {
+            entry->x = e->x;
+            entry->y = e->y;
+            entry->width = e->width;
+            entry->height = e->height;
+        }
+
+        return;
     }
+
+    /* Focus waits for the MapNotify from inside the frame, an unmapped window can't take it */
+    setup_window(e->window, e->x, e->y, e->width, e->height, e->border_width, 0);
 }
 
 
@@ -184,10 +778,18 @@ destroy_window(xcb_generic_event_t *event)
         focused_window = NULL;
     }
 
+    /* Gone before adoption mapped it again, the focus goes to whatever maps next */
+    if (adopt_focus == e->window) {
+        adopt_focus = XCB_NONE;
+    }
+
     client = find_client(&e->window);
 
-    if (client) {
+    /* A frame only goes away after its client, which is already forgotten by then */
+    if (client && client->window == e->window) {
         close_window(client->window);
+    } else if (!client) {
+        remove_slot(&unmanaged, e->window);
     }
 }
 
@@ -196,20 +798,67 @@ map_window(xcb_generic_event_t *event)
 {
     xcb_map_notify_event_t *e;
     e = (xcb_map_notify_event_t *)event;
+    struct unmanaged *entry;
     struct client *client;
 
     client = find_client(&e->window);
 
+    /* A window can drop override-redirect before it maps, manage it from then on */
     if (!client) {
+        if (e->override_redirect || !(entry = lookup_slot(&unmanaged, e->window))) {
+            return;
+        }
+
+        client = setup_window(entry->window, entry->x, entry->y,
+                              entry->width, entry->height, BORDER_UNKNOWN, 0);
+        remove_slot(&unmanaged, e->window);
+
+        /* It could have been restacked anywhere while it was unmanaged */
+        if (client) {
+            stack_known = false;
+        }
+
+        /* The reparent maps it again inside the frame, that MapNotify does the rest */
+        return;
+    }
+
+    /*
+     * Only maps inside the frame count. The root sees our frames and the
+     * unmap and map of a window reparented while it was mapped
+     */
+    if (e->window != client->window || e->event != client->frame) {
+        return;
+    }
+
+    /* Moving into a frame of its own depth maps it again in there, that MapNotify does the rest */
+    if (resolve_depth(client)) {
         return;
     }
 
     client->mapped = true;
 
+    /* Mapped on a workspace that isn't shown, the frame waits for the switch */
+    if (client->workspace != focused_workspace) {
+        client->hidden = true;
+        return;
+    }
+
+    xcb_map_window(connection, client->frame);
+
+    /* Adoption maps every viewable window again, only the topmost of them takes the focus */
+    if (adopt_focus) {
+        if (client->window != adopt_focus) {
+            return;
+        }
+
+        adopt_focus = XCB_NONE;
+    }
+
     if (!e->override_redirect) {
         focus(client, ACTIVE);
     }
 
+    /* Already done by focus() most of the time, the model makes it free then */
     raise_current_window();
 }
 
@@ -223,7 +872,8 @@ unmap_window(xcb_generic_event_t *event)
 
     client = find_client(&e->window);
 
-    if (!client) {
+    /* Workspace switches only unmap frames, so anything inside one is the client's doing */
+    if (!client || e->window != client->window || e->event != client->frame) {
         return;
     }
 
@@ -233,7 +883,10 @@ unmap_window(xcb_generic_event_t *event)
         focused_window = NULL;
     }
 
-    xcb_unmap_window(connection, client->window);
+    /* Otherwise the frame stays behind as an empty border */
+    if (!client->hidden) {
+        xcb_unmap_window(connection, client->frame);
+    }
 }
 
 
@@ -245,7 +898,9 @@ enter_window(xcb_generic_event_t *event)
     struct client *client;
 
     if (config.sloppy_focus) {
-        if (focused_window && focused_window->window == e->event) {
+        /* Back on the focused window before the focus moved, a pending target is stale */
+        if (focused_window && focused_window->frame == e->event) {
+            focus_target = NULL;
             return;
         }
 
@@ -255,7 +910,8 @@ enter_window(xcb_generic_event_t *event)
             return;
         }
 
-        focus(client, ACTIVE);
+        /* Only the window the pointer ends up on gets focused */
+        schedule_focus(client);
     }
 }
 
@@ -265,24 +921,105 @@ configure_window(xcb_generic_event_t *event)
 {
     xcb_configure_notify_event_t *e;
     e = (xcb_configure_notify_event_t *)event;
+    const struct insets *target;
+    struct unmanaged *entry;
     struct client *client;
+    uint16_t stale;
+    bool moved;
+
+    /* Only the geometry matters for an unmanaged window, in case it gets managed */
+    if ((entry = lookup_slot(&unmanaged, e->window))) {
+        entry->x = e->x;
+        entry->y = e->y;
+        entry->width = e->width;
+        entry->height = e->height;
+        return;
+    }
+
+    if (!(client = find_client(&e->window))) {
+        return;
+    }
+
+    /* Frames are what stack among the other clients, the client only counts inside its frame */
+    if (e->window == client->frame) {
+        restack_notify(client, e->above_sibling, event->full_sequence);
+    } else if (e->event != client->frame) {
+        return;
+    }
 
-    if ((client = find_client(&e->window))) {
-        if (client != focused_window) {
-            focus(client, INACTIVE);
+    /*
+     * Mirror the geometry so nothing has to ask the server for it, except what
+     * a configure of ours still in flight is about to overwrite. Borders and
+     * stacking are left alone, redoing them here fed on our own configures
+     */
+    if (e->window == client->frame) {
+        stale = stale_fields(event->full_sequence, client->frame_sequence, &client->frame_pending);
+
+        if (!(stale & XCB_CONFIG_WINDOW_X)) {
+            client->x = e->x;
+        }
+        if (!(stale & XCB_CONFIG_WINDOW_Y)) {
+            client->y = e->y;
         }
+        if (!(stale & XCB_CONFIG_WINDOW_WIDTH)) {
+            client->outer_width = e->width;
+        }
+        if (!(stale & XCB_CONFIG_WINDOW_HEIGHT)) {
+            client->outer_height = e->height;
+        }
+
+        return;
+    }
+
+    stale = stale_fields(event->full_sequence, client->window_sequence, &client->window_pending);
+
+    if (!(stale & XCB_CONFIG_WINDOW_X)) {
+        client->inner_x = e->x;
+    }
+    if (!(stale & XCB_CONFIG_WINDOW_Y)) {
+        client->inner_y = e->y;
+    }
+    if (!(stale & XCB_CONFIG_WINDOW_WIDTH)) {
+        client->width = e->width;
+    }
+    if (!(stale & XCB_CONFIG_WINDOW_HEIGHT)) {
+        client->height = e->height;
+    }
+    if (!(stale & XCB_CONFIG_WINDOW_BORDER_WIDTH)) {
+        client->border_width = e->border_width;
+    }
 
-        focus(focused_window, ACTIVE);
+    /* The client moved or resized itself, the frame follows and it goes back in place */
+    target = client->maxed ? &no_insets : &insets;
+    moved = client->inner_x != target->x || client->inner_y != target->y;
+    configure_border(client, 0);
+    configure_client(client, client->x + client->inner_x - target->x,
+                     client->y + client->inner_y - target->y, client->width, client->height);
+
+    if (moved) {
+        notify_client(client);
+    }
+}
+
+
+static uint16_t
+stale_fields(uint32_t sequence, uint32_t newest, uint16_t *pending)
+{
+    /* Sent after our last configure, the server is caught up with all of them */
+    if ((int32_t)(sequence - newest) >= 0) {
+        *pending = 0;
     }
+
+    return *pending;
 }
 
 
 static void
-button_press(xcb_generic_event_t *event, struct client *client,
-            xcb_get_geometry_reply_t *geometry, uint32_t *values)
+button_press(xcb_generic_event_t *event)
 {
     xcb_button_press_event_t *e;
     e = (xcb_button_press_event_t *)event;
+    struct client *client;
 
     client = find_client(&e->child);
 
@@ -290,25 +1027,34 @@ button_press(xcb_generic_event_t *event, struct client *client,
         return;
     }
 
-    geometry = xcb_get_geometry_reply(connection,
-                    xcb_get_geometry(connection, client->window), NULL);
+    drag.client = client;
+    drag.button = e->detail;
+    drag.pending = false;
+    drag.moved = false;
 
+    /* Where the warp puts the pointer, the client sits inset in its frame */
     if(e->detail == 1) {
-        values[2] = 1;
+        drag.root_x = client->x + client->inner_x + client->width/2;
+        drag.root_y = client->y + client->inner_y + client->height/2;
         xcb_warp_pointer(connection, XCB_NONE, client->window,
-            0, 0, 0, 0, geometry->width/2, geometry->height/2);
+            0, 0, 0, 0, client->width/2, client->height/2);
     } else {
-        values[2] = 3;
+        drag.button = 3;
+        drag.root_x = client->x + client->inner_x + client->width;
+        drag.root_y = client->y + client->inner_y + client->height;
         xcb_warp_pointer(connection, XCB_NONE, client->window,
-            0, 0, 0, 0, geometry->width, geometry->height);
+            0, 0, 0, 0, client->width, client->height);
     }
 
-    xcb_grab_pointer(connection, 0, screen->root,
+    /*
+     * No motion hint, every event carries the position so no query is needed.
+     * Nothing reads the grab status, so its reply would sit in XCB forever
+     */
+    xcb_discard_reply(connection, xcb_grab_pointer(connection, 0, screen->root,
         XCB_EVENT_MASK_BUTTON_RELEASE
-            | XCB_EVENT_MASK_BUTTON_MOTION
-            | XCB_EVENT_MASK_POINTER_MOTION_HINT,
+            | XCB_EVENT_MASK_BUTTON_MOTION,
             XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC,
-            screen->root, XCB_NONE, XCB_CURRENT_TIME);
+            screen->root, XCB_NONE, XCB_CURRENT_TIME).sequence);
 
     focused_window = client;
     raise_current_window();
@@ -316,654 +1062,3012 @@ button_press(xcb_generic_event_t *event, struct client *client,
 
 
 static void
-mouse_motion(struct client *client, xcb_get_geometry_reply_t *geometry,
-             uint32_t *values)
+mouse_motion(xcb_generic_event_t *event)
 {
     /* TODO: Pointer icon or maybe module? */
-    xcb_query_pointer_reply_t *pointer;
-    pointer = xcb_query_pointer_reply(connection,
-            xcb_query_pointer(connection, screen->root), 0);
-    if (values[2] == 1) {
-        geometry = xcb_get_geometry_reply(connection,
-            xcb_get_geometry(connection, client->window), NULL);
-        if (!geometry)
-            return;
+    xcb_motion_notify_event_t *e;
+    e = (xcb_motion_notify_event_t *)event;
 
-        values[0] = (pointer->root_x + geometry->width / 2
-            > screen->width_in_pixels
-            - (config.border_width*2))
-            ? screen->width_in_pixels - geometry->width
-            - (config.border_width*2)
-            : pointer->root_x - geometry->width / 2;
-        values[1] = (pointer->root_y + geometry->height / 2
-            > screen->height_in_pixels
-            - (config.border_width*2))
-            ? (screen->height_in_pixels - geometry->height
-            - (config.border_width*2))
-            : pointer->root_y - geometry->height / 2;
-
-        if (pointer->root_x < geometry->width/2)
-            values[0] = 0;
-        if (pointer->root_y < geometry->height/2)
-            values[1] = 0;
-
-        /* CHange to one of the functions so the wrapper's value also update */
-        xcb_configure_window(connection, client->window,
-            XCB_CONFIG_WINDOW_X
-            | XCB_CONFIG_WINDOW_Y, values);
-        xcb_flush(connection);
-    } else if (values[2] == 3) {
-        geometry = xcb_get_geometry_reply(connection,
-            xcb_get_geometry(connection, client->window), NULL);
-        values[0] = pointer->root_x - geometry->x;
-        values[1] = pointer->root_y - geometry->y;
-        xcb_configure_window(connection, client->window,
-            XCB_CONFIG_WINDOW_WIDTH
-            | XCB_CONFIG_WINDOW_HEIGHT, values);
+    if (!drag.client) {
+        return;
+    }
+
+    /* Only remember the latest position, queued motion collapses into it */
+    drag.root_x = e->root_x;
+    drag.root_y = e->root_y;
+    drag.pending = true;
+
+    /* The first motion goes out at once, the rest wait for the next frame */
+    if (!drag.paced) {
+        apply_drag();
+        pace_drag(true);
     }
-    xcb_flush(connection);
 }
 
 
 static void
-button_release(struct client *client)
+button_release(xcb_generic_event_t *event)
 {
+    xcb_button_release_event_t *e;
+    e = (xcb_button_release_event_t *)event;
+    struct client *client = drag.client;
+
+    if (client) {
+        drag.root_x = e->root_x;
+        drag.root_y = e->root_y;
+        drag.pending = true;
+        apply_drag();
+
+        /* Once per drag, not per frame, so moving costs the one configure it did unframed */
+        if (drag.button == 1 && drag.moved) {
+            notify_client(client);
+        }
+    }
+
+    pace_drag(false);
+    drag.client = NULL;
+    drag.button = 0;
+
     focus(client, ACTIVE);
     xcb_ungrab_pointer(connection, XCB_CURRENT_TIME);
 }
 
 
 static void
-raise_current_window(void)
+key_press(xcb_generic_event_t *event)
 {
-    raise_window(focused_window->window);
-}
+    xcb_key_press_event_t *e;
+    e = (xcb_key_press_event_t *)event;
+    xcb_keysym_t keysym = keysyms[e->detail];
+    char command[BUFSIZ];
+    const char *error;
+
+    for (size_t i = 0; i < LENGTH(keys); i++) {
+        if (keys[i].keysym != keysym || keys[i].modifiers != KEYMASK(e->state)) {
+            continue;
+        }
 
-static void
-minimize_current_window(void)
-{
-    minimize_window(focused_window);
+        /* run_command() takes the words apart in place */
+        snprintf(command, sizeof(command), "%s", keys[i].command);
+
+        if ((error = run_command(command))) {
+            warnx("chisai: %s: %s", keys[i].command, error);
+        }
+    }
 }
 
+
 static void
-close_current_window(void)
+mapping_notify(xcb_generic_event_t *event)
 {
-    close_window(focused_window->window);
+    xcb_mapping_notify_event_t *e;
+    e = (xcb_mapping_notify_event_t *)event;
+
+    /* The keycodes bound keys sit on may have moved */
+    if (e->request == XCB_MAPPING_KEYBOARD) {
+        grab_keys();
+    }
 }
 
+
 static void
-toggle_maximize_window(void)
+grab_keys(void)
 {
-    if (!focused_window || focused_window->window == screen->root) {
+    /* Grabbed with every lock too, so Caps Lock and Num Lock don't get in the way */
+    static const uint16_t locks[] = {
+        0, XCB_MOD_MASK_LOCK, XCB_MOD_MASK_2, XCB_MOD_MASK_LOCK | XCB_MOD_MASK_2
+    };
+    xcb_get_keyboard_mapping_reply_t *mapping;
+    xcb_keysym_t *symbols;
+    int length, per_keycode;
+
+    mapping = xcb_get_keyboard_mapping_reply(connection,
+            xcb_get_keyboard_mapping(connection, min_keycode,
+                                     max_keycode - min_keycode + 1), NULL);
+
+    if (!mapping) {
         return;
     }
 
-    if (focused_window->maxed) {
-        unmax_window(focused_window);
-        focused_window->maxed = false;
-        set_borders(focused_window, ACTIVE);
-    } else {
-        set_borders(focused_window, INACTIVE);
-        maximize_window(focused_window);
-        focused_window->maxed = true;
+    symbols = xcb_get_keyboard_mapping_keysyms(mapping);
+    length = xcb_get_keyboard_mapping_keysyms_length(mapping);
+    per_keycode = mapping->keysyms_per_keycode;
+    memset(keysyms, 0, sizeof(keysyms));
+
+    /* Only the unshifted keysym is kept, bindings name keys by it */
+    for (int keycode = min_keycode; keycode <= max_keycode; keycode++) {
+        if ((keycode - min_keycode) * per_keycode < length) {
+            keysyms[keycode] = symbols[(keycode - min_keycode) * per_keycode];
+        }
     }
 
-    raise_current_window();
-}
+    free(mapping);
+    xcb_ungrab_key(connection, XCB_GRAB_ANY, screen->root, XCB_MOD_MASK_ANY);
 
-static struct client*
-setup_window(xcb_window_t window)
-{
-    struct client *client;
-    struct node *node;
+    /* A replay resolves key presses with this mapping, not the fake's */
+    if (recording) {
+        record_keymap();
+    }
 
-    node = add_node(window_list);
-    client = malloc(sizeof(struct client));
+    for (int keycode = min_keycode; keycode <= max_keycode; keycode++) {
+        for (size_t i = 0; i < LENGTH(keys); i++) {
+            if (!keysyms[keycode] || keysyms[keycode] != keys[i].keysym) {
+                continue;
+            }
 
-    if (!node  || !client) {
-        return NULL;
+            for (size_t j = 0; j < LENGTH(locks); j++) {
+                xcb_grab_key(connection, 1, screen->root, keys[i].modifiers | locks[j],
+                             keycode, XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC);
+            }
+        }
     }
+}
 
-    node->data = client;
 
-    client->window = window;
+static struct workspace*
+get_workspace(uint16_t number)
+{
+    struct workspace *grown;
 
-    /* Reset all values */
-    client->x = 0;
-    client->y = 0;
-    client->width= 0;
-    client->height = 0;
-    client->depth= 0;
+    if (number >= workspaces_length) {
+        if (!(grown = realloc(workspaces, (number + 1) * sizeof(struct workspace)))) {
+            return NULL;
+        }
+
+        memset(grown + workspaces_length, 0,
+               (number + 1 - workspaces_length) * sizeof(struct workspace));
+        workspaces = grown;
+        workspaces_length = number + 1;
+    }
+
+    return &workspaces[number];
+}
+
+
+static bool
+attach_client(struct client *client, uint16_t number)
+{
+    struct workspace *workspace;
+    struct client **grown;
+    uint32_t capacity;
+
+    if (!(workspace = get_workspace(number))) {
+        return false;
+    }
+
+    if (workspace->length == workspace->capacity) {
+        capacity = workspace->capacity ? workspace->capacity * 2 : 16;
+
+        if (!(grown = realloc(workspace->clients, capacity * sizeof(struct client *)))) {
+            return false;
+        }
+
+        workspace->clients = grown;
+        workspace->capacity = capacity;
+    }
+
+    client->workspace = number;
+    client->index = workspace->length;
+    workspace->clients[workspace->length++] = client;
+
+    return true;
+}
+
+
+static void
+detach_client(struct client *client)
+{
+    struct workspace *workspace;
+
+    if (!client->workspace) {
+        return;
+    }
+
+    workspace = &workspaces[client->workspace];
+
+    /* Fill the hole with the last client so the array stays dense */
+    workspace->clients[client->index] = workspace->clients[--workspace->length];
+    workspace->clients[client->index]->index = client->index;
+
+    if (workspace->focused == client) {
+        workspace->focused = NULL;
+    }
+
+    client->workspace = 0;
+}
+
+
+static const char*
+switch_workspace(const union value *value)
+{
+    struct workspace *outgoing, *incoming;
+    struct client *client;
+
+    if ((uint32_t)value->i > config.workspaces) {
+        return "no such workspace";
+    }
+
+    if (value->i == focused_workspace) {
+        return NULL;
+    }
+
+    if (!(incoming = get_workspace(value->i))) {
+        return "out of memory";
+    }
+
+    outgoing = get_workspace(focused_workspace);
+    outgoing->focused = focused_window;
+
+    /* Hide everything first so the two workspaces never show at once */
+    for (uint32_t i = 0; i < outgoing->length; i++) {
+        client = outgoing->clients[i];
+
+        if (client->mapped && !client->hidden) {
+            client->hidden = true;
+            xcb_unmap_window(connection, client->frame);
+        }
+    }
+
+    /* Only frames are mapped and unmapped, so the clients never notice */
+    for (uint32_t i = 0; i < incoming->length; i++) {
+        client = incoming->clients[i];
+
+        if (client->hidden) {
+            client->hidden = false;
+            xcb_map_window(connection, client->frame);
+        }
+    }
+
+    focused_workspace = value->i;
+    focused_window = NULL;
+    focus(incoming->focused, ACTIVE);
+
+    return NULL;
+}
+
+
+static void
+stack_client(struct client *client, struct client *below)
+{
+    /* NULL puts the client at the bottom */
+    client->below = below;
+    client->above = below ? below->above : stack_bottom;
+
+    if (client->above) {
+        client->above->below = client;
+    } else {
+        stack_top = client;
+    }
+
+    if (below) {
+        below->above = client;
+    } else {
+        stack_bottom = client;
+    }
+}
+
+
+static void
+unstack_client(struct client *client)
+{
+    if (client->below) {
+        client->below->above = client->above;
+    } else if (stack_bottom == client) {
+        stack_bottom = client->above;
+    }
+
+    if (client->above) {
+        client->above->below = client->below;
+    } else if (stack_top == client) {
+        stack_top = client->below;
+    }
+
+    client->below = NULL;
+    client->above = NULL;
+}
+
+
+static void
+raise_window(struct client *client)
+{
+    /* Override-redirect windows don't count, on top means over every client */
+    if (client == stack_top && stack_known) {
+        return;
+    }
+
+    unstack_client(client);
+    stack_client(client, stack_top);
+
+    /* The request waits for flush_stacking(), a batch only sends the final order */
+    if (!client->restack) {
+        client->restack = true;
+        restacks_pending++;
+    }
+
+    stack_known = true;
+}
+
+
+static void
+restack_notify(struct client *client, xcb_window_t sibling, uint32_t sequence)
+{
+    struct client *below;
+
+    /* Already where the model has it, like every ConfigureNotify of a move */
+    if ((!sibling && !client->below)
+        || (client->below && client->below->frame == sibling)) {
+        return;
+    }
+
+    below = sibling ? find_client(&sibling) : NULL;
+
+    /*
+     * The order predates a restack of ours the model is already past, or the
+     * client is over a window that isn't one, like a menu. Either way its place
+     * is unknown, only the next raise can settle which client is on top
+     */
+    if ((int32_t)(sequence - restack_sequence) < 0 || (sibling && !below)) {
+        if (client != stack_top) {
+            stack_known = false;
+        }
+
+        return;
+    }
+
+    unstack_client(client);
+    stack_client(client, below);
+}
+
+
+static void
+flush_stacking(void)
+{
+    uint32_t values[] = { XCB_STACK_MODE_ABOVE };
+    struct client *client = stack_top;
+    uint32_t remaining = restacks_pending;
+
+    if (!restacks_pending) {
+        return;
+    }
+
+    /* Raised clients sit at or near the top, find the lowest of them */
+    for (; client; client = client->below) {
+        if (client->restack && !--remaining) {
+            break;
+        }
+    }
+
+    /* Then send them bottom to top, each raise ends over the one before */
+    for (; client; client = client->above) {
+        if (!client->restack) {
+            continue;
+        }
+
+        restack_sequence = xcb_configure_window(connection, client->frame,
+                XCB_CONFIG_WINDOW_STACK_MODE, values).sequence;
+        newest_sequence = restack_sequence;
+
+        client->restack = false;
+    }
+
+    restacks_pending = 0;
+}
+
+
+static int
+flush_batch(void)
+{
+    /* Without a delay the last window entered in the batch wins */
+    if (focus_target && !config.focus_delay) {
+        flush_focus();
+    }
+
+    if (borders_stale) {
+        repaint_borders();
+    }
+
+    flush_stacking();
+
+    return xcb_flush(connection);
+}
+
+
+static void
+schedule_focus(struct client *client)
+{
+    focus_target = client;
+
+    if (!config.focus_delay) {
+        return;
+    }
+
+    /* Every enter pushes the deadline back, the timer catches up when it fires */
+    focus_deadline = now() + config.focus_delay * 1000000ull;
+
+    if (!focus_armed) {
+        arm_focus(config.focus_delay * 1000000ull);
+    }
+}
+
+
+static void
+arm_focus(uint64_t delay)
+{
+    struct itimerspec timer = { { 0, 0 }, { 0, 0 } };
+
+    timer.it_value.tv_sec = delay / 1000000000u;
+    timer.it_value.tv_nsec = delay % 1000000000u;
+    timerfd_settime(focus_fd, 0, &timer, NULL);
+    focus_armed = true;
+}
+
+
+static void
+settle_focus(void)
+{
+    uint64_t time = now();
+
+    focus_armed = false;
+
+    /* The pointer moved on since the timer was set, wait out the rest */
+    if (focus_target && time < focus_deadline) {
+        arm_focus(focus_deadline - time);
+        return;
+    }
+
+    if (focus_target) {
+        run_focus();
+    }
+}
+
+
+static void
+flush_focus(void)
+{
+    struct client *client = focus_target;
+
+    focus_target = NULL;
+
+    /* Already settled, a replayed timer can fire with nothing left to do */
+    if (!client) {
+        return;
+    }
+
+    /* Minimized or switched away from while it was pending */
+    if (!client->mapped || client->hidden) {
+        return;
+    }
+
+    focus(client, ACTIVE);
+}
+
+
+static void
+pace_drag(bool paced)
+{
+    struct itimerspec frame = { { 0, 0 }, { 0, 0 } };
+
+    if (drag.paced == paced) {
+        return;
+    }
+
+    /* At 1 per second the whole interval is a second, which tv_nsec can't hold */
+    if (paced) {
+        frame.it_interval.tv_sec = 1 / MAX(config.refresh_rate, 1);
+        frame.it_interval.tv_nsec = 1000000000L / MAX(config.refresh_rate, 1) % 1000000000L;
+        frame.it_value = frame.it_interval;
+    }
+
+    /* Unpaced, every motion goes out at once rather than none until the release */
+    if (timerfd_settime(frame_fd, 0, &frame, NULL) < 0) {
+        return;
+    }
+
+    drag.paced = paced;
+}
+
+
+static void
+drag_frame(void)
+{
+    /* Stop ticking once the pointer has come to rest */
+    if (!drag.client || !drag.pending) {
+        pace_drag(false);
+        return;
+    }
+
+    apply_drag();
+}
+
+
+static void
+apply_drag(void)
+{
+    struct client *client = drag.client;
+    uint32_t values[2];
+    int32_t x, y;
+
+    if (!client || !drag.pending) {
+        return;
+    }
+
+    drag.pending = false;
+
+    if (drag.button == 1) {
+        /* The pointer holds the middle of the client, the frame is the inset further out */
+        x = drag.root_x - client->inner_x - client->width / 2;
+        y = drag.root_y - client->inner_y - client->height / 2;
+
+        /* Kept on the screen, the top left corner wins on a screen too small for it */
+        x = MAX(MIN(x, screen->width_in_pixels - client->outer_width), 0);
+        y = MAX(MIN(y, screen->height_in_pixels - client->outer_height), 0);
+
+        if (x != client->x || y != client->y) {
+            drag.moved = true;
+        }
+
+        configure_client(client, x, y, client->width, client->height);
+    } else if (drag.button == 3) {
+        values[0] = MAX(drag.root_x - client->x - client->inner_x, 1);
+        values[1] = MAX(drag.root_y - client->y - client->inner_y, 1);
+
+        configure_client(client, client->x, client->y, values[0], values[1]);
+    }
+}
+
+
+static void
+raise_current_window(void)
+{
+    if (!focused_window) {
+        return;
+    }
+
+    raise_window(focused_window);
+}
+
+static void
+minimize_current_window(void)
+{
+    minimize_window(focused_window);
+}
+
+static void
+close_current_window(void)
+{
+    if (!focused_window) {
+        return;
+    }
+
+    close_window(focused_window->window);
+}
+
+static void
+toggle_maximize_window(void)
+{
+    if (!focused_window || focused_window->window == screen->root) {
+        return;
+    }
+
+    if (focused_window->maxed) {
+        unmax_window(focused_window);
+        focused_window->maxed = false;
+        set_borders(focused_window, ACTIVE);
+    } else {
+        set_borders(focused_window, INACTIVE);
+        maximize_window(focused_window);
+        focused_window->maxed = true;
+    }
+
+    raise_current_window();
+}
+
+static struct client*
+setup_window(xcb_window_t window, int16_t x, int16_t y,
+             uint16_t width, uint16_t height, uint16_t border_width, uint8_t depth)
+{
+    struct client *client;
+
+    client = add_client(&clients, window);
+
+    if (!client) {
+        return NULL;
+    }
+
+    /* Already framed, there is nothing left to set up */
+    if (client->frame) {
+        return client;
+    }
+
+    if (!client->workspace && !attach_client(client, focused_workspace)) {
+        delete_client(&clients, window);
+        return NULL;
+    }
+
+    /* The frame goes where the client was, so the client itself doesn't move */
+    client->x = x - insets.x;
+    client->y = y - insets.y;
+    client->width = width;
+    client->height = height;
+    client->inner_x = insets.x;
+    client->inner_y = insets.y;
+    client->outer_width = width + insets.width;
+    client->outer_height = height + insets.height;
+    client->border_width = border_width;
+    client->border = config.unfocus_color;
+    client->frame_pending = 0;
+    client->window_pending = 0;
+    client->maxed = false;
+
+    /* Group leaders and helpers are never mapped, only a MapNotify from inside the frame says so */
+    client->mapped = false;
+    client->depth_cookie.sequence = 0;
+
+    /*
+     * A CreateNotify doesn't carry the depth. Frame at the root depth for now
+     * and ask, the reply is in by the time the client maps inside the frame
+     */
+    if (!depth) {
+        client->depth_cookie = xcb_get_geometry(connection, window);
+    }
+
+    if (!frame_client(client, depth ? depth : screen->root_depth)) {
+        if (client->depth_cookie.sequence) {
+            xcb_discard_reply(connection, client->depth_cookie.sequence);
+        }
+
+        detach_client(client);
+        delete_client(&clients, window);
+        return NULL;
+    }
+
+    return client;
+}
+
+
+static bool
+frame_client(struct client *client, uint8_t depth)
+{
+    const struct frame_visual *visual;
+    struct client_slot *slot;
+    xcb_window_t frame;
+    uint32_t values[4];
+
+    /* Deeper than any visual there is a frame for, it gets one at the root depth */
+    if (!(visual = get_frame_visual(depth))) {
+        depth = screen->root_depth;
+        visual = get_frame_visual(depth);
+    }
+
+    frame = xcb_generate_id(connection);
+
+    if (!(slot = insert_slot(&clients.table, frame))) {
+        return false;
+    }
+
+    slot->client = client;
+
+    /* Enter for sloppy focus, substructure for whatever the client does in the frame */
+    values[0] = client->border;
+    values[1] = 0;
+    values[2] = XCB_EVENT_MASK_ENTER_WINDOW | XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY;
+    values[3] = visual->colormap;
+
+    xcb_create_window(connection, depth, frame, screen->root,
+                      client->x, client->y, client->outer_width, client->outer_height, 0,
+                      XCB_WINDOW_CLASS_INPUT_OUTPUT, visual->visual,
+                      XCB_CW_BACK_PIXEL | XCB_CW_BORDER_PIXEL | XCB_CW_EVENT_MASK | XCB_CW_COLORMAP,
+                      values);
+
+    /* Should chisai go away the client goes back to the root instead of down with the frame */
+    if (!client->frame) {
+        xcb_change_save_set(connection, XCB_SET_MODE_INSERT, client->window);
+        configure_border(client, 0);
+    }
+
+    xcb_reparent_window(connection, client->window, frame, client->inner_x, client->inner_y);
+
+    /* Only a frame of the wrong depth gets replaced, the client has already left it */
+    if (client->frame) {
+        remove_slot(&clients.table, client->frame);
+        xcb_destroy_window(connection, client->frame);
+    }
+
+    client->frame = frame;
+    client->depth = depth;
+
+    /* New windows go on top, and adoption goes through them bottom to top */
+    unstack_client(client);
+    stack_client(client, stack_top);
+    stack_known = true;
+
+    return true;
+}
+
+
+static bool
+resolve_depth(struct client *client)
+{
+    xcb_get_geometry_reply_t *geometry;
+    uint8_t depth;
+
+    if (!client->depth_cookie.sequence) {
+        return false;
+    }
+
+    /* Gone from the server, a replay for one, it keeps the frame it has */
+    geometry = xcb_get_geometry_reply(connection, client->depth_cookie, NULL);
+    client->depth_cookie.sequence = 0;
+
+    if (!geometry) {
+        return false;
+    }
+
+    depth = geometry->depth;
+    free(geometry);
+
+    /* Most clients share the root depth, only ARGB and the like need a frame of their own */
+    if (depth == client->depth || !get_frame_visual(depth)) {
+        return false;
+    }
+
+    /* The fake only knows the depth a replay gives it, which comes from here */
+    if (recording) {
+        struct record_depth record = { .window = client->window, .depth = depth };
+
+        record_input(RECORD_DEPTH, &record, sizeof(record));
+    }
+
+    return frame_client(client, depth);
+}
+
+
+static const struct frame_visual*
+get_frame_visual(uint8_t depth)
+{
+    struct frame_visual *cached;
+    xcb_depth_iterator_t depths;
+    xcb_visualtype_iterator_t visuals;
+
+    if (depth > MAX_DEPTH) {
+        return NULL;
+    }
+
+    cached = &frame_visuals[depth];
+
+    if (cached->visual) {
+        return cached;
+    }
+
+    /* The root depth has everything already, any other gets its colormap once */
+    if (depth == screen->root_depth) {
+        cached->visual = screen->root_visual;
+        cached->colormap = screen->default_colormap;
+        return cached;
+    }
+
+    for (depths = xcb_screen_allowed_depths_iterator(screen); depths.rem; xcb_depth_next(&depths)) {
+        if (depths.data->depth != depth) {
+            continue;
+        }
+
+        for (visuals = xcb_depth_visuals_iterator(depths.data); visuals.rem; xcb_visualtype_next(&visuals)) {
+            if (visuals.data->_class != XCB_VISUAL_CLASS_TRUE_COLOR) {
+                continue;
+            }
+
+            cached->visual = visuals.data->visual_id;
+            cached->colormap = xcb_generate_id(connection);
+            xcb_create_colormap(connection, XCB_COLORMAP_ALLOC_NONE, cached->colormap,
+                                screen->root, cached->visual);
+
+            return cached;
+        }
+    }
+
+    return NULL;
+}
+
+
+static void
+update_insets(void)
+{
+    uint16_t width = config.border_width;
+
+    /* The client sits past the border on its side, and the frame grows by it */
+    switch (config.border_side) {
+        case TOP: {
+            insets = (struct insets){ 0, width, 0, width };
+        } break;
+
+        case BOTTOM: {
+            insets = (struct insets){ 0, 0, 0, width };
+        } break;
+
+        case RIGHT: {
+            insets = (struct insets){ 0, 0, width, 0 };
+        } break;
+
+        case LEFT: {
+            insets = (struct insets){ width, 0, width, 0 };
+        } break;
+
+        case ALL: {
+            insets = (struct insets){ width, width, width * 2, width * 2 };
+        } break;
+    }
+}
+
+
+static void
+set_borders(struct client *client, int mode)
+{
+    uint32_t values[1];
+
+    /* A maxed client covers all of its frame, there is no border to see */
+    if(client->maxed) {
+        return;
+    }
+
+    if (mode == ACTIVE) {
+        values[0] = config.focus_color;
+    } else {
+        values[0] = config.unfocus_color;
+    }
+
+    /* The frame already shows this color, like on every repeated focus */
+    if (values[0] == client->border) {
+        return;
+    }
+
+    client->border = values[0];
+    xcb_change_window_attributes(connection, client->frame, XCB_CW_BACK_PIXEL, values);
+
+    /* A new background only shows once the frame is cleared, the client covers the rest */
+    xcb_clear_area(connection, 0, client->frame, 0, 0, 0, 0);
+}
+
+
+static void
+repaint_borders(void)
+{
+    /* Once per batch however many settings changed, the setters already redid the insets */
+    for (struct client *client = clients.head; client; client = client->next) {
+        configure_client(client, client->x, client->y, client->width, client->height);
+        set_borders(client, client == focused_window ? ACTIVE : INACTIVE);
+    }
+
+    borders_stale = false;
+}
+
+
+static void
+configure_client(struct client *client, int16_t x, int16_t y, uint16_t width, uint16_t height)
+{
+    const struct insets *target = client->maxed ? &no_insets : &insets;
+    uint32_t values[4];
+    uint16_t mask = 0;
+    int length = 0;
+
+    /*
+     * Only what differs from where the windows are, or are about to be, goes
+     * out. A move only ever touches the frame, the client rides along in it
+     */
+    if (client->x != x) {
+        mask |= XCB_CONFIG_WINDOW_X;
+        values[length++] = (uint32_t)(int32_t)x;
+    }
+    if (client->y != y) {
+        mask |= XCB_CONFIG_WINDOW_Y;
+        values[length++] = (uint32_t)(int32_t)y;
+    }
+    if (client->outer_width != width + target->width) {
+        mask |= XCB_CONFIG_WINDOW_WIDTH;
+        values[length++] = width + target->width;
+    }
+    if (client->outer_height != height + target->height) {
+        mask |= XCB_CONFIG_WINDOW_HEIGHT;
+        values[length++] = height + target->height;
+    }
+
+    if (mask) {
+        client->x = x;
+        client->y = y;
+        client->outer_width = width + target->width;
+        client->outer_height = height + target->height;
+        client->frame_sequence = xcb_configure_window(connection, client->frame,
+                                                      mask, values).sequence;
+        client->frame_pending |= mask;
+        newest_sequence = client->frame_sequence;
+    }
+
+    mask = 0;
+    length = 0;
+
+    if (client->inner_x != target->x) {
+        mask |= XCB_CONFIG_WINDOW_X;
+        values[length++] = (uint32_t)(int32_t)target->x;
+    }
+    if (client->inner_y != target->y) {
+        mask |= XCB_CONFIG_WINDOW_Y;
+        values[length++] = (uint32_t)(int32_t)target->y;
+    }
+    if (client->width != width) {
+        mask |= XCB_CONFIG_WINDOW_WIDTH;
+        values[length++] = width;
+    }
+    if (client->height != height) {
+        mask |= XCB_CONFIG_WINDOW_HEIGHT;
+        values[length++] = height;
+    }
+
+    if (!mask) {
+        return;
+    }
+
+    client->inner_x = target->x;
+    client->inner_y = target->y;
+    client->width = width;
+    client->height = height;
+    client->window_sequence = xcb_configure_window(connection, client->window,
+                                                   mask, values).sequence;
+    client->window_pending |= mask;
+    newest_sequence = client->window_sequence;
+}
+
+
+static void
+configure_border(struct client *client, uint16_t width)
+{
+    uint32_t values[1] = { width };
+
+    if (client->border_width == width) {
+        return;
+    }
+
+    client->border_width = width;
+    client->window_sequence = xcb_configure_window(connection, client->window,
+            XCB_CONFIG_WINDOW_BORDER_WIDTH, values).sequence;
+    client->window_pending |= XCB_CONFIG_WINDOW_BORDER_WIDTH;
+    newest_sequence = client->window_sequence;
+}
+
+
+static void
+notify_client(struct client *client)
+{
+    /* Sent as 32 bytes, which is more than the event itself */
+    union {
+        xcb_configure_notify_event_t e;
+        char bytes[32];
+    } event = { .e = {
+        .response_type = XCB_CONFIGURE_NOTIFY,
+        .event = client->window,
+        .window = client->window,
+        .x = client->x + client->inner_x,
+        .y = client->y + client->inner_y,
+        .width = client->width,
+        .height = client->height,
+    } };
+
+    /* Moving the frame tells the client nothing, ICCCM has it told where it is on the root */
+    xcb_send_event(connection, 0, client->window, XCB_EVENT_MASK_STRUCTURE_NOTIFY, event.bytes);
+}
+
+
+static void
+maximize_window(struct client *client)
+{
+    client->original_size.x      = client->x;
+    client->original_size.y      = client->y;
+    client->original_size.width  = client->width;
+    client->original_size.height = client->height;
+
+    /* Maxed first, so the client fills the frame instead of leaving room for the border */
+    client->maxed = true;
+    configure_client(client, 0, 0, screen->width_in_pixels, screen->height_in_pixels);
+}
+
+
+static void
+unmax_window(struct client *client)
+{
+    if (!client) {
+        return;
+    }
+
+    client->maxed = false;
+    configure_client(client, client->original_size.x, client->original_size.y,
+                     client->original_size.width, client->original_size.height);
+}
+
+
+static void
+minimize_window(struct client *client)
+{
+    if (!client || !client->mapped) {
+        return;
+    }
+
+    client->mapped = false;
+    xcb_unmap_window(connection, client->window);
+}
+
+
+static struct client*
+find_client(const xcb_drawable_t *window)
+{
+    return lookup_client(&clients, *window);
+}
+
+
+static void
+forget_window(xcb_window_t window)
+{
+    struct client *client;
+
+    if (!(client = find_client(&window))) {
+        return;
+    }
+
+    if (focused_window == client) {
+        focused_window = NULL;
+    }
+
+    if (focus_target == client) {
+        focus_target = NULL;
+    }
+
+    if (drag.client == client) {
+        pace_drag(false);
+        drag.client = NULL;
+    }
+
+    detach_client(client);
+
+    /* Whatever was under it is only the top of the model */
+    if (client == stack_top) {
+        stack_known = false;
+    }
+
+    unstack_client(client);
+    restacks_pending -= client->restack;
+
+    /* Nothing will ask for the depth now, its reply would sit in XCB forever */
+    if (client->depth_cookie.sequence) {
+        xcb_discard_reply(connection, client->depth_cookie.sequence);
+    }
+
+    /* The client is gone or about to be, the frame would only be an empty border */
+    xcb_destroy_window(connection, client->frame);
+    delete_client(&clients, window);
+}
+
+
+static void
+close_window(xcb_drawable_t window)
+{
+    xcb_kill_client(connection, window);
+    forget_window(window);
+}
+
+
+static uint32_t
+get_color(const char *hex)
+{
+    uint32_t rgb48;
+    char strgroups[7] = {
+        hex[1], hex[2], hex[3], hex[4], hex[5], hex[6], '\0'
+    };
+
+    rgb48 = strtol(strgroups, NULL, 16);
+    return rgb48 | 0xff000000;
+}
+
+
+static int
+compare_command(const void *name, const void *command)
+{
+    return strcmp(name, ((const struct command *)command)->name);
+}
+
+
+static const char*
+parse_value(const struct command *command, const char *word, union value *value)
+{
+    char *end;
+    long number;
+
+    switch (command->type) {
+        case VALUE_INT: {
+            errno = 0;
+            number = strtol(word, &end, 10);
+
+            if (errno || *end || end == word) {
+                return "argument is not a number";
+            }
+
+            if (number < command->min || number > command->max) {
+                return "argument out of range";
+            }
+
+            value->i = number;
+        } break;
+
+        case VALUE_BOOL: {
+            if (!strcmp(word, "true")) {
+                value->b = true;
+            } else if (!strcmp(word, "false")) {
+                value->b = false;
+            } else {
+                return "argument is not true or false";
+            }
+        } break;
+
+        case VALUE_SIDE: {
+            for (value->side = TOP; value->side <= ALL; value->side++) {
+                if (!strcmp(word, sides[value->side])) {
+                    return NULL;
+                }
+            }
+
+            return "invalid border side";
+        }
+
+        case VALUE_COLOR: {
+            if (word[0] != '#' || strlen(word) != 7 || strspn(word + 1, "0123456789abcdefABCDEF") != 6) {
+                return "argument is not a color like #rrggbb";
+            }
+
+            value->color = get_color(word);
+        } break;
+
+        case VALUE_STRING: {
+            value->s = word;
+        } break;
+
+        case VALUE_NONE: {
+        } break;
+    }
+
+    return NULL;
+}
+
+
+static const char*
+set_border_width(const union value *value)
+{
+    config.border_width = value->i;
+    update_insets();
+    borders_stale = true;
+    return NULL;
+}
+
+
+static const char*
+set_border_side(const union value *value)
+{
+    config.border_side = value->side;
+    update_insets();
+    borders_stale = true;
+    return NULL;
+}
+
+
+static const char*
+set_focus_color(const union value *value)
+{
+    config.focus_color = value->color;
+    borders_stale = true;
+    return NULL;
+}
+
+
+static const char*
+set_unfocus_color(const union value *value)
+{
+    config.unfocus_color = value->color;
+    borders_stale = true;
+    return NULL;
+}
+
+
+static const char*
+set_focus_delay(const union value *value)
+{
+    config.focus_delay = value->i;
+    return NULL;
+}
+
+
+static const char*
+set_refresh_rate(const union value *value)
+{
+    config.refresh_rate = value->i;
+    return NULL;
+}
+
+
+static const char*
+set_sloppy_focus(const union value *value)
+{
+    config.sloppy_focus = value->b;
+    return NULL;
+}
+
+
+static const char*
+set_workspaces(const union value *value)
+{
+    config.workspaces = value->i;
+    return NULL;
+}
+
+
+static const char*
+set_stats(const union value *value)
+{
+    config.stats = value->b;
+    return NULL;
+}
+
+
+static const char*
+set_trace(const union value *value)
+{
+    config.trace = value->b;
+    return NULL;
+}
+
+
+static uint64_t
+now(void)
+{
+    struct timespec time;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000u + time.tv_nsec;
+}
+
+
+static uint64_t
+start_timing(void)
+{
+    /* A branch is all it costs while stats and the trace are off */
+    if (!config.stats && !config.trace) {
+        return 0;
+    }
+
+    return now();
+}
+
+
+static void
+record_timing(int slot, uint64_t start, uint32_t requests)
+{
+    struct histogram *histogram = &histograms[slot];
+    struct trace_event *event;
+    uint64_t elapsed;
+    int bucket;
+
+    /* Stats may have been turned on in the middle of the handler */
+    if (!start) {
+        return;
+    }
+
+    elapsed = now() - start;
+
+    if (config.stats) {
+        bucket = elapsed ? 64 - __builtin_clzll(elapsed) : 0;
+
+        histogram->count++;
+        histogram->total += elapsed;
+        histogram->max = MAX(histogram->max, elapsed);
+        histogram->buckets[bucket < 32 ? bucket : 31]++;
+    }
+
+    /* The ring just overwrites the oldest event, it never has to be emptied */
+    if (config.trace) {
+        event = &trace[trace_length++ & (TRACE_SIZE - 1)];
+        event->start = start;
+        event->duration = MIN(elapsed, UINT32_MAX);
+        event->slot = slot;
+        event->requests = MIN(requests, UINT16_MAX);
+    }
+}
+
+
+static void
+show_stats(void)
+{
+    struct histogram *histogram;
+    char line[512];
+    int length;
+
+    if (!requester) {
+        return;
+    }
+
+    for (int slot = 0; slot < STAT_SLOTS; slot++) {
+        histogram = &histograms[slot];
+
+        if (!histogram->count) {
+            continue;
+        }
+
+        /* Name, count, mean and max, then every bucket as upper bound:count */
+        length = snprintf(line, sizeof(line), "%s %llu mean %lluns max %lluns |",
+                          stat_name(slot), (unsigned long long)histogram->count,
+                          (unsigned long long)(histogram->total / histogram->count),
+                          (unsigned long long)histogram->max);
+
+        for (int bucket = 0; bucket < 32 && length < (int)sizeof(line); bucket++) {
+            if (histogram->buckets[bucket]) {
+                length += snprintf(line + length, sizeof(line) - length, " %llu:%u",
+                                   1ull << bucket, histogram->buckets[bucket]);
+            }
+        }
+
+        reply(requester, "> %s\n", line);
+    }
+}
+
+
+static const char*
+stat_name(int slot)
+{
+    static char name[16];
+
+    if (stat_names[slot]) {
+        return stat_names[slot];
+    }
+
+    snprintf(name, sizeof(name), "event_%d", slot);
+    return name;
+}
+
+
+static void
+reset_stats(void)
+{
+    memset(histograms, 0, sizeof(histograms));
+    memset(traffic, 0, sizeof(traffic));
+}
+
+
+static void
+count_request(void)
+{
+    traffic[charged].requests++;
+    unflushed++;
+}
+
+
+static int
+count_flush(xcb_connection_t *connection)
+{
+    uint64_t timing = start_timing();
+    uint32_t requests = unflushed;
+    int flushed;
+
+    traffic[charged].flushes++;
+    unflushed = 0;
+
+    flushed = backend->flush(connection);
+    record_timing(STAT_FLUSH, timing, requests);
+
+    return flushed;
+}
+
+
+static void
+begin_reply(void)
+{
+    traffic[charged].replies++;
+    reply_start = config.stats ? now() : 0;
+}
+
+
+static void*
+end_reply(void *reply)
+{
+    if (reply_start) {
+        traffic[charged].waited += now() - reply_start;
+    }
+
+    return reply;
+}
+
+
+static void
+show_traffic(void)
+{
+    for (int slot = 0; slot < STAT_SLOTS && requester; slot++) {
+        if (traffic[slot].requests || traffic[slot].replies || traffic[slot].flushes) {
+            reply(requester, "> %s requests %llu replies %llu waited %lluns flushes %llu\n",
+                  stat_name(slot),
+                  (unsigned long long)traffic[slot].requests,
+                  (unsigned long long)traffic[slot].replies,
+                  (unsigned long long)traffic[slot].waited,
+                  (unsigned long long)traffic[slot].flushes);
+        }
+    }
+}
+
+
+static const char*
+dump_trace(const union value *value)
+{
+    struct trace_event *event;
+    uint64_t first;
+    FILE *file;
+
+    if (!(file = fopen(value->s, "w"))) {
+        return "failed to open the trace file";
+    }
+
+    /* Oldest first, only the last TRACE_SIZE events are still around */
+    first = trace_length > TRACE_SIZE ? trace_length - TRACE_SIZE : 0;
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", file);
+
+    for (uint64_t i = first; i < trace_length; i++) {
+        event = &trace[i & (TRACE_SIZE - 1)];
+
+        fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+                "\"ts\":%llu.%03llu,\"dur\":%u.%03u,\"args\":{\"requests\":%u}}",
+                i == first ? "" : ",", stat_name(event->slot),
+                (unsigned long long)(event->start / 1000),
+                (unsigned long long)(event->start % 1000),
+                event->duration / 1000, event->duration % 1000, event->requests);
+    }
+
+    fputs("\n]}\n", file);
+
+    if (fclose(file)) {
+        return "failed to write the trace file";
+    }
+
+    return NULL;
+}
+
+
+static void
+print_traffic(void)
+{
+    for (int slot = 0; slot < STAT_SLOTS; slot++) {
+        if (traffic[slot].requests || traffic[slot].replies || traffic[slot].flushes) {
+            fprintf(stderr, "chisai: %s requests %llu replies %llu waited %lluns flushes %llu\n",
+                    stat_name(slot),
+                    (unsigned long long)traffic[slot].requests,
+                    (unsigned long long)traffic[slot].replies,
+                    (unsigned long long)traffic[slot].waited,
+                    (unsigned long long)traffic[slot].flushes);
+        }
+    }
+}
+
+
+static void
+cleanup(void)
+{
+    print_traffic();
+
+    if (recording) {
+        fclose(recording);
+    }
+
+    while (clients.head) {
+        delete_client(&clients, clients.head->window);
+    }
+
+    free(clients.table.slots);
+    free_pool(&client_pool);
+    free(unmanaged.slots);
+    free(spare_peer);
+
+    for (size_t i = 0; i < LENGTH(config_values); i++) {
+        free(config_values[i]);
+    }
+
+    if (config_fd >= 0) {
+        close(config_fd);
+    }
+
+    for (uint16_t i = 0; i < workspaces_length; i++) {
+        free(workspaces[i].clients);
+    }
+
+    free(workspaces);
+
+    if (connection) {
+        xcb_disconnect(connection);
+    }
+}
+
+
+static int
+socket_deploy(void)
+{
+    struct sockaddr_un sock_addr;
+
+    /* Get socket path */
+    sock_path = getenv("CHISAI_SOCKET");
+    memset(&sock_addr, 0, sizeof(sock_addr));
+
+    if (sock_path) {
+        strncpy(sock_addr.sun_path, sock_path, sizeof(sock_addr.sun_path));
+    } else {
+        strncpy(sock_addr.sun_path, "/tmp/chisai.sock", sizeof(sock_addr.sun_path));
+    }
+
+    /* Create socket, never let it block the X side of the loop */
+    if ((sock_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        return -1;
+    }
+
+    if (fcntl(sock_fd, F_SETFL, O_NONBLOCK) < 0
+        || fcntl(sock_fd, F_SETFD, FD_CLOEXEC) < 0) {
+        return -1;
+    }
+
+    sock_addr.sun_family = AF_UNIX;
+
+    unlink(sock_addr.sun_path);
+
+    /* Bind socket */
+    if (bind(sock_fd, (struct sockaddr*)&sock_addr, sizeof(sock_addr)) < 0) {
+        return -1;
+    }
+
+    /* Listen to the socket */
+    if (listen(sock_fd, SOMAXCONN) < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+x_deploy(void)
+{
+    /* Init XCB and grab events */
+    uint32_t values[2];
+    int mask;
+
+    /* Make sure XCB and the screen are working properly */
+    if (xcb_connection_has_error(connection = xcb_connect(NULL, NULL))) {
+        return -1;
+    }
+
+    if (!(screen = xcb_setup_roots_iterator(xcb_get_setup(connection)).data)) {
+        return -1;
+    }
+
+    /* Grab mouse buttons */
+    xcb_grab_button(connection, 0, screen->root, XCB_EVENT_MASK_BUTTON_PRESS |
+			XCB_EVENT_MASK_BUTTON_RELEASE, XCB_GRAB_MODE_ASYNC,
+			XCB_GRAB_MODE_ASYNC, screen->root, XCB_NONE, 1, MOD);
+
+	xcb_grab_button(connection, 0, screen->root, XCB_EVENT_MASK_BUTTON_PRESS |
+			XCB_EVENT_MASK_BUTTON_RELEASE, XCB_GRAB_MODE_ASYNC,
+            XCB_GRAB_MODE_ASYNC, screen->root, XCB_NONE, 3, MOD);
+
+    /* Grab the bound keys, the keycode range comes with the connection */
+    min_keycode = xcb_get_setup(connection)->min_keycode;
+    max_keycode = xcb_get_setup(connection)->max_keycode;
+    grab_keys();
+
+    if (timer_deploy() < 0) {
+        return -1;
+    }
+
+    /* Update mask and root */
+    mask = XCB_CW_EVENT_MASK;
+    values[0] = XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY;
+	xcb_change_window_attributes_checked(connection, screen->root, mask, values);
+
+    xcb_flush(connection);
+
+    return 0;
+}
+
+
+static int
+timer_deploy(void)
+{
+    /* Timer pacing the configures sent while dragging */
+    if ((frame_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+        return -1;
+    }
+
+    /* Timer waiting for the pointer to settle before sloppy focus follows it */
+    if ((focus_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static void
+load_defaults(void)
+{
+    config.border_side   = BORDER_SIDE;
+    config.border_width  = BORDER_WIDTH;
+    config.focus_color   = get_color(COLOR_FOCUS);
+    config.unfocus_color = get_color(COLOR_UNFOCUS);
+    config.workspaces    = WORKSPACES;
+    config.sloppy_focus  = SLOPPY_FOCUS;
+    config.focus_delay   = FOCUS_DELAY;
+    config.refresh_rate  = REFRESH_RATE;
+    config.stats         = STATS;
+    config.trace         = TRACE;
+
+    update_insets();
+}
+
+
+static void
+load_config(void)
+{
+    const char *path = getenv("CHISAI_CONFIG");
+    char directory[PATH_MAX];
+    char *slash;
+
+    if (path) {
+        snprintf(config_file, sizeof(config_file), "%s", path);
+    } else if (!config_path(config_file, sizeof(config_file), "chisai.conf")) {
+        return;
+    }
+
+    read_config();
+
+    /* Editors tend to write a new file and rename it over, so watch the directory */
+    snprintf(directory, sizeof(directory), "%s", config_file);
+
+    if (!(slash = strrchr(directory, '/'))) {
+        config_name = config_file;
+        snprintf(directory, sizeof(directory), ".");
+    } else {
+        config_name = config_file + (slash - directory) + 1;
+        slash[slash == directory] = '\0';
+    }
+
+    if ((config_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+        warnx("chisai: config changes won't be picked up until restart");
+        return;
+    }
+
+    /* No directory means nothing to reload, the defaults stay */
+    if (inotify_add_watch(config_fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        close(config_fd);
+        config_fd = -1;
+    }
+}
+
+
+static bool
+config_path(char *path, size_t size, const char *name)
+{
+    const char *home;
+    int length;
+
+    if ((home = getenv("XDG_CONFIG_HOME")) && *home) {
+        length = snprintf(path, size, "%s/chisai/%s", home, name);
+    } else if ((home = getenv("HOME")) && *home) {
+        length = snprintf(path, size, "%s/.config/chisai/%s", home, name);
+    } else {
+        return false;
+    }
 
-    client->mapped = true;
-    client->maxed = false;
+    return length > 0 && (size_t)length < size;
+}
 
-    get_geometry(&client->window, &client->x, &client->y,
-            &client->width, &client->height, &client->depth);
-    client->workspace = focused_workspace;
 
-    return client;
+static void
+read_config(void)
+{
+    const struct command *command;
+    char line[BUFSIZ], name[BUFSIZ], message[BUFSIZ * 2];
+    char *key, *value, *end;
+    const char *error;
+    unsigned number = 0;
+    size_t index;
+    FILE *file;
+
+    /* No config file is fine, the defaults from config.h stay */
+    if (!(file = fopen(config_file, "r"))) {
+        return;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        number++;
+
+        key = line + strspn(line, " \t");
+        key[strcspn(key, "\r\n")] = '\0';
+
+        if (!*key || *key == '#') {
+            continue;
+        }
+
+        value = key + strcspn(key, " \t");
+
+        if (*value) {
+            *value++ = '\0';
+        }
+
+        value += strspn(value, " \t");
+
+        for (end = value + strlen(value); end > value && (end[-1] == ' ' || end[-1] == '\t'); end--) {
+            end[-1] = '\0';
+        }
+
+        /* Same names as the config command, "border_width 5" is "config border_width 5" */
+        snprintf(name, sizeof(name), "config %s", key);
+
+        if (!(command = bsearch(name, commands, LENGTH(commands), sizeof(commands[0]), compare_command))) {
+            warnx("chisai: %s:%u: unknown setting %s", config_file, number, key);
+            continue;
+        }
+
+        index = command - commands;
+
+        if (config_values[index] && strcmp(config_values[index], value) == 0) {
+            continue;
+        }
+
+        snprintf(message, sizeof(message), "%s %s", name, value);
+
+        /* Goes through execute_command so a recording replays the same settings */
+        if ((error = execute_command(message))) {
+            warnx("chisai: %s:%u: %s", config_file, number, error);
+            continue;
+        }
+
+        free(config_values[index]);
+        config_values[index] = strdup(value);
+    }
+
+    fclose(file);
+}
+
+
+static void
+reload_config(void)
+{
+    _Alignas(struct inotify_event) char buffer[4096];
+    const struct inotify_event *event;
+    bool changed = false;
+    ssize_t length;
+
+    while ((length = read(config_fd, buffer, sizeof(buffer))) > 0) {
+        for (char *next = buffer; next < buffer + length; next += sizeof(*event) + event->len) {
+            event = (const struct inotify_event *)next;
+
+            if (event->len && strcmp(event->name, config_name) == 0) {
+                changed = true;
+            }
+        }
+    }
+
+    /* A setting taken out of the file keeps its value, only lines that changed are applied */
+    if (changed) {
+        read_config();
+        flush_batch();
+    }
+}
+
+
+static void
+autostart(void)
+{
+    char path[PATH_MAX];
+
+    /* Settings are read above, chisairc is only left to start other programs */
+    if (!config_path(path, sizeof(path), "chisairc") || access(path, X_OK) < 0) {
+        return;
+    }
+
+    if (fork() == 0) {
+        /* An ignored SIGCHLD survives exec, and would leave wait() in chisairc failing with ECHILD */
+        signal(SIGCHLD, SIG_DFL);
+        setsid();
+        execl(path, "chisairc", (char *)NULL);
+        _exit(EXIT_FAILURE);
+    }
+}
+
+
+static void
+adopt_windows(void)
+{
+    xcb_query_tree_reply_t *tree;
+    xcb_window_t *children;
+    xcb_get_window_attributes_cookie_t *attributes_cookies;
+    xcb_get_geometry_cookie_t *geometry_cookies;
+    xcb_get_window_attributes_reply_t *attributes;
+    xcb_get_geometry_reply_t *geometry;
+    struct record_adopt adopt;
+    int length;
+
+    tree = xcb_query_tree_reply(connection,
+            xcb_query_tree(connection, screen->root), NULL);
+
+    if (!tree) {
+        return;
+    }
+
+    children = xcb_query_tree_children(tree);
+    length = xcb_query_tree_children_length(tree);
+    attributes_cookies = malloc(length * sizeof(xcb_get_window_attributes_cookie_t));
+    geometry_cookies = malloc(length * sizeof(xcb_get_geometry_cookie_t));
+
+    if (!attributes_cookies || !geometry_cookies) {
+        free(attributes_cookies);
+        free(geometry_cookies);
+        free(tree);
+        return;
+    }
+
+    /* Send every request before waiting on any, so it all costs one round trip */
+    for (int i = 0; i < length; i++) {
+        attributes_cookies[i] = xcb_get_window_attributes(connection, children[i]);
+        geometry_cookies[i] = xcb_get_geometry(connection, children[i]);
+    }
+
+    /* Children come bottom to top, so the last one adopted ends up focused */
+    for (int i = 0; i < length; i++) {
+        attributes = xcb_get_window_attributes_reply(connection, attributes_cookies[i], NULL);
+        geometry = xcb_get_geometry_reply(connection, geometry_cookies[i], NULL);
+
+        if (attributes && geometry) {
+            adopt.window = children[i];
+            adopt.x = geometry->x;
+            adopt.y = geometry->y;
+            adopt.width = geometry->width;
+            adopt.height = geometry->height;
+            adopt.border_width = geometry->border_width;
+            adopt.depth = geometry->depth;
+            adopt.override_redirect = attributes->override_redirect;
+            adopt.input_only = attributes->_class == XCB_WINDOW_CLASS_INPUT_ONLY;
+            adopt.viewable = attributes->map_state == XCB_MAP_STATE_VIEWABLE;
+
+            adopt_window(&adopt);
+        }
+
+        free(attributes);
+        free(geometry);
+    }
+
+    free(attributes_cookies);
+    free(geometry_cookies);
+    free(tree);
+}
+
+
+static void
+adopt_window(const struct record_adopt *adopt)
+{
+    struct unmanaged *entry;
+    struct client *client;
+
+    /* Nothing else tells a replay what was there before the first event */
+    if (recording) {
+        record_input(RECORD_ADOPT, adopt, sizeof(*adopt));
+    }
+
+    if (adopt->override_redirect) {
+        if ((entry = insert_slot(&unmanaged, adopt->window))) {
+            entry->x = adopt->x;
+            entry->y = adopt->y;
+            entry->width = adopt->width;
+            entry->height = adopt->height;
+        }
+
+        return;
+    }
+
+    if (adopt->input_only || !(client = setup_window(adopt->window, adopt->x, adopt->y,
+                                                     adopt->width, adopt->height,
+                                                     adopt->border_width, adopt->depth))) {
+        return;
+    }
+
+    /*
+     * Reparenting a viewable window unmaps it and maps it again in the
+     * frame, that MapNotify maps the frame like for any other client
+     */
+    if (adopt->viewable) {
+        adopt_focus = client->window;
+    }
+}
+
+
+static void
+focus(struct client *client, int mode)
+{
+    if (mode == ACTIVE){
+        /* Whatever asked for the focus now outranks a pending sloppy focus */
+        focus_target = NULL;
+
+        if (!client) {
+            focused_window = NULL;
+            xcb_set_input_focus(connection, XCB_NONE,
+                XCB_INPUT_FOCUS_POINTER_ROOT, XCB_CURRENT_TIME);
+            return;
+        }
+
+        /* Don't bother focusing root or the window already in focus */
+        if (!client->maxed && (client == focused_window || client->window == screen->root)) {
+            return;
+        }
+
+        if (focused_window) {
+            focus(focused_window, INACTIVE);
+        }
+
+        xcb_set_input_focus(connection, XCB_INPUT_FOCUS_POINTER_ROOT,
+            client->window, XCB_CURRENT_TIME);
+
+        focused_window = client;
+        set_borders(client, ACTIVE);
+        raise_current_window();
+    } else if (mode == INACTIVE) {
+        if (!focused_window || focused_window->window == screen->root) {
+            return;
+        }
+
+        set_borders(focused_window, INACTIVE);
+    }
+}
+
+
+static int
+loop_deploy(void)
+{
+    if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        return -1;
+    }
+
+    if (watch_fd(xcb_get_file_descriptor(connection)) < 0
+        || watch_fd(sock_fd) < 0 || watch_fd(frame_fd) < 0
+        || watch_fd(focus_fd) < 0) {
+        return -1;
+    }
+
+    if (config_fd >= 0 && watch_fd(config_fd) < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+watch_fd(int fd)
+{
+    struct epoll_event event = { .events = EPOLLIN, .data.fd = fd };
+
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+
+static void
+accept_peers(void)
+{
+    struct peer *peer;
+    struct peer **grown;
+    int fd;
+
+    while ((fd = accept(sock_fd, NULL, 0)) >= 0) {
+        if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0 || fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+            close(fd);
+            continue;
+        }
+
+        /* Peers are looked up by their descriptor */
+        if (fd >= peers_capacity) {
+            int capacity = MAX(peers_capacity * 2, fd + 1);
+
+            if (!(grown = realloc(peers, capacity * sizeof(struct peer *)))) {
+                close(fd);
+                continue;
+            }
+
+            memset(grown + peers_capacity, 0,
+                   (capacity - peers_capacity) * sizeof(struct peer *));
+            peers = grown;
+            peers_capacity = capacity;
+        }
+
+        /* maikuro connects once per command, keep reusing the last peer */
+        if (spare_peer) {
+            peer = spare_peer;
+            spare_peer = NULL;
+        } else if (!(peer = malloc(sizeof(struct peer)))) {
+            close(fd);
+            continue;
+        }
+
+        peer->fd = fd;
+        peer->length = 0;
+        peer->pending = 0;
+        peer->closing = false;
+        peer->writing = false;
+        peers[fd] = peer;
+
+        if (watch_fd(fd) < 0) {
+            close_peer(peer);
+        }
+    }
+}
+
+
+static void
+read_peer(struct peer *peer)
+{
+    ssize_t length;
+
+    length = read(peer->fd, peer->buffer + peer->length,
+                  sizeof(peer->buffer) - peer->length);
+
+    if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return;
+    }
+
+    if (length <= 0) {
+        /* Hang up once every reply made it out */
+        peer->closing = true;
+        write_peer(peer);
+        return;
+    }
+
+    peer->length += length;
+    serve_peer(peer);
+}
+
+
+static void
+serve_peer(struct peer *peer)
+{
+    size_t start, i;
+    bool full;
+
+    do {
+        full = false;
+
+        /* Messages end with a newline, or a NUL for older clients */
+        for (start = 0, i = 0; i < peer->length; i++) {
+            if (peer->buffer[i] != '\n' && peer->buffer[i] != '\0') {
+                continue;
+            }
+
+            /* No room left for the replies, the rest waits until the output drains */
+            if (sizeof(peer->output) - peer->pending < PEER_RESERVE) {
+                full = true;
+                break;
+            }
+
+            peer->buffer[i] = '\0';
+
+            /* Every command gets its status back, in order */
+            if (i > start) {
+                const char *error;
+
+                requester = peer;
+                error = execute_command(peer->buffer + start);
+                requester = NULL;
+
+                if (error) {
+                    reply(peer, "error: %s\n", error);
+                } else {
+                    reply(peer, "ok\n");
+                }
+            }
+
+            start = i + 1;
+        }
+
+        peer->length -= start;
+        memmove(peer->buffer, peer->buffer + start, peer->length);
+
+        /* A message that can never fit is dropped along with its sender */
+        if (!full && peer->length == sizeof(peer->buffer)) {
+            peer->closing = true;
+        }
+
+        /* All the replies so far go out together */
+        if (!write_peer(peer)) {
+            return;
+        }
+
+        /* Keep going while the socket takes everything, otherwise EPOLLOUT picks it up */
+    } while (full && !peer->pending);
 }
 
 
 static bool
-get_geometry(const xcb_drawable_t *window, int16_t *x, int16_t *y,
-             uint16_t *height, uint16_t *width, uint8_t *depth)
+write_peer(struct peer *peer)
 {
-    xcb_get_geometry_reply_t *geometry = xcb_get_geometry_reply(connection,
-            xcb_get_geometry(connection, *window), NULL);
+    struct epoll_event event = { .events = EPOLLIN, .data.fd = peer->fd };
+    ssize_t length = 0;
 
-    if (!geometry) {
+    if (peer->pending) {
+        length = send(peer->fd, peer->output, peer->pending, MSG_NOSIGNAL);
+    }
+
+    if (length < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        peer->pending = 0;
+        peer->closing = true;
+    }
+
+    if (length > 0) {
+        peer->pending -= length;
+        memmove(peer->output, peer->output + length, peer->pending);
+    }
+
+    if (peer->closing && !peer->pending) {
+        close_peer(peer);
         return false;
     }
 
-    *x = geometry->x;
-    *y = geometry->y;
-    *width = geometry->width;
-    *height = geometry->height;
-    *depth = geometry->depth;
+    /* Nothing more is read while replies are waiting, the socket holds on to it */
+    if (peer->pending) {
+        event.events = EPOLLOUT;
+    } else if (!peer->writing) {
+        return true;
+    }
+
+    peer->writing = peer->pending > 0;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, peer->fd, &event);
 
-    free(geometry);
     return true;
 }
 
 
 static void
-set_borders(struct client *client, int mode)
+reply(struct peer *peer, const char *fmt, ...)
 {
-    uint32_t values[1];
+    size_t room = sizeof(peer->output) - peer->pending;
+    va_list ap;
+    int length;
 
-    if(client->maxed) {
+    if (peer->closing) {
         return;
     }
 
-    values[0] = config.border_width;
+    va_start(ap, fmt);
+    length = vsnprintf(peer->output + peer->pending, room, fmt, ap);
+    va_end(ap);
 
-    /* TODO: Finish setting different borders depending on option */
-    xcb_rectangle_t border_rect[] = {
-        {1, 1, 1, 1},
-    };
+    /* A client that stops reading its replies is not worth waiting for */
+    if (length < 0 || (size_t)length >= room) {
+        peer->closing = true;
+        peer->pending = 0;
+        return;
+    }
 
-    xcb_pixmap_t pmap = xcb_generate_id(connection);
-    xcb_gcontext_t gc = xcb_generate_id(connection);
+    peer->pending += length;
+}
 
-    xcb_create_gc(connection, gc, pmap, 0, NULL);
 
-    if (mode == ACTIVE) {
-        values[0] = config.focus_color;
-    } else if (mode == INACTIVE) {
-        values[0] = config.unfocus_color;
+static void
+close_peer(struct peer *peer)
+{
+    /* Closing also takes the descriptor out of the epoll set */
+    peers[peer->fd] = NULL;
+    close(peer->fd);
+
+    if (spare_peer) {
+        free(peer);
+    } else {
+        spare_peer = peer;
+    }
+}
+
+
+static const char*
+run_command(char *message)
+{
+    const struct command *command;
+    const char *error;
+    union value value;
+    char name[64];
+    char *word, *state;
+
+    if (!(word = strtok_r(message, " \t", &state))) {
+        return "empty command";
+    }
+
+    /* Settings and trace commands are two words long, everything else is one */
+    if (!strcmp(word, "config") || !strcmp(word, "trace")) {
+        snprintf(name, sizeof(name), "%s", word);
+
+        if (!(word = strtok_r(NULL, " \t", &state))) {
+            return "incomplete command";
+        }
+
+        snprintf(name + strlen(name), sizeof(name) - strlen(name), " %s", word);
+    } else {
+        snprintf(name, sizeof(name), "%s", word);
+    }
+
+    command = bsearch(name, commands, LENGTH(commands),
+                      sizeof(commands[0]), compare_command);
+
+    if (!command) {
+        return "unknown command";
+    }
+
+    word = strtok_r(NULL, " \t", &state);
+
+    if (command->type == VALUE_NONE) {
+        if (word) {
+            return "too many arguments";
+        }
+
+        command->action();
+        return NULL;
+    }
+
+    if (!word) {
+        return "missing argument";
+    }
+
+    if ((error = parse_value(command, word, &value))) {
+        return error;
+    }
+
+    if (strtok_r(NULL, " \t", &state)) {
+        return "too many arguments";
     }
 
-    xcb_change_gc(connection, gc, XCB_GC_FOREGROUND, &values[0]);
-    xcb_poly_fill_rectangle(connection, pmap, gc, 5, border_rect);
-    values[0] = pmap;
-    xcb_change_window_attributes(connection, client->window, XCB_CW_BORDER_PIXMAP,
-            &values[0]);
+    return command->set(&value);
+}
+
+
+static void
+handle_events(void)
+{
+    xcb_generic_event_t *event;
 
-    xcb_free_pixmap(connection, pmap);
-    xcb_free_gc(connection, gc);
+    while ((event = xcb_poll_for_event(connection))) {
+        handle_event(event);
+    }
 }
 
 
 static void
-resize_window(xcb_drawable_t window, const uint16_t width, const uint16_t height)
+handle_event(xcb_generic_event_t *event)
 {
-    uint32_t values[2] = { width, height };
-
-    if (screen->root == window || window == 0) {
-        return;
+    if (recording) {
+        record_input(RECORD_EVENT, event, sizeof(xcb_raw_generic_event_t));
     }
 
-    xcb_configure_window(connection, window, XCB_CONFIG_WINDOW_WIDTH
-                        | XCB_CONFIG_WINDOW_HEIGHT, values);
+    dispatch_event(event);
+    free(event);
 }
 
-/* TODO: Move window function as well */
 
 static void
-maximize_window(struct client *client)
+dispatch_event(xcb_generic_event_t *event)
 {
-    uint32_t values[4];
-
-    client->original_size.x      = client->x;
-    client->original_size.y      = client->y;
-    client->original_size.width  = client->width;
-    client->original_size.height = client->height;
+    uint64_t timing = start_timing();
 
-    client->x = 0;
-	client->y = 0;
-	client->width = screen->width_in_pixels;
-    client->height = screen->height_in_pixels;
+    charged = CLEANMASK(event->response_type);
 
-    values[0] = 0;
-	xcb_configure_window(connection, client->window, XCB_CONFIG_WINDOW_BORDER_WIDTH,
-                        values);
+    /* Handle all the X events we are accepting */
+    switch(CLEANMASK(event->response_type))
+    {
+        /* Change this to new window because they can just unmap and map windows
+         * Then handle new windows in the window created event and don't map and then
+         * in the map event map the window if it can be found 
+         */
+        case XCB_CREATE_NOTIFY: {
+            new_window(event);
+        } break;
+
+        case XCB_DESTROY_NOTIFY: {
+            destroy_window(event);
+        } break;
+
+        case XCB_MAP_NOTIFY: {
+            map_window(event);
+        } break;
+
+        case XCB_UNMAP_NOTIFY: {
+            unmap_window(event);
+        } break;
+
+        case XCB_ENTER_NOTIFY: {
+            enter_window(event);
+        } break;
+
+        case XCB_BUTTON_PRESS: {
+            button_press(event);
+        } break;
+
+        case XCB_MOTION_NOTIFY: {
+            mouse_motion(event);
+        } break;
+
+        case XCB_BUTTON_RELEASE: {
+            button_release(event);
+        } break;
+
+        case XCB_CONFIGURE_NOTIFY: {
+            configure_window(event);
+        } break;
+
+        case XCB_KEY_PRESS: {
+            key_press(event);
+        } break;
+
+        case XCB_MAPPING_NOTIFY: {
+            mapping_notify(event);
+        } break;
+    }
 
-    move_resize_window(client->window, client->x, client->y,
-                       client->width, client->height);
-    client->maxed = true;
+    record_timing(CLEANMASK(event->response_type), timing, 0);
+    charged = STAT_LOOP;
 }
 
 
-static void
-unmax_window(struct client *client)
+static const char*
+execute_command(char *message)
 {
-    if (!client) {
-        return;
+    uint64_t timing = start_timing();
+    const char *error;
+
+    if (recording) {
+        record_input(RECORD_COMMAND, message, strlen(message));
     }
 
-    client->x = client->original_size.x;
-    client->y = client->original_size.y;
-    client->width = client->original_size.width;
-    client->height = client->original_size.height;
+    charged = STAT_COMMAND;
+    error = run_command(message);
+    charged = STAT_LOOP;
+    record_timing(STAT_COMMAND, timing, 0);
 
-    client->maxed = false;
-    move_resize_window(client->window, client->x, client->y,
-                       client->width, client->height);
+    return error;
 }
 
 
 static void
-minimize_window(struct client *client)
+run_frame(void)
 {
-    if (!client) {
-        return;
+    uint64_t timing = start_timing();
+
+    if (recording) {
+        record_input(RECORD_FRAME, NULL, 0);
     }
 
-    client->mapped = false;
-    xcb_unmap_window(connection, client->window);
+    charged = STAT_FRAME;
+    drag_frame();
+    charged = STAT_LOOP;
+    record_timing(STAT_FRAME, timing, 0);
 }
 
 
 static void
-move_resize_window(xcb_drawable_t window, const uint16_t x, const uint16_t y,
-                   const uint16_t width, const uint16_t height)
+run_focus(void)
 {
-    uint32_t values[4] = { x, y, width, height };
-
-	if (screen->root == window || 0 == window)
-		return;
+    uint64_t timing = start_timing();
 
-	xcb_configure_window(connection, window, XCB_CONFIG_WINDOW_X
-			| XCB_CONFIG_WINDOW_Y | XCB_CONFIG_WINDOW_WIDTH
-			| XCB_CONFIG_WINDOW_HEIGHT, values);
+    if (recording) {
+        record_input(RECORD_FOCUS, NULL, 0);
+    }
 
-    xcb_flush(connection);
+    charged = STAT_FOCUS;
+    flush_focus();
+    charged = STAT_LOOP;
+    record_timing(STAT_FOCUS, timing, 0);
 }
 
 
-static struct client*
-find_client(const xcb_drawable_t *window)
+static void
+events_loop(void)
 {
-    struct client *client;
-    struct node *node;
+    struct epoll_event events[MAX_EVENTS];
+    xcb_generic_event_t *event;
+    int ready;
 
-    for (node = window_list->head; node; node = node->next) {
-        client = node->data;
+    while (true)
+    {
+        /* 
+         * Drain X before every wait, waiting on a reply can queue events
+         * without the X file descriptor ever becoming readable. The first time
+         * round this sends what adopting the windows and the config queued
+         */
+        handle_events();
+
+        if (recording) {
+            record_input(RECORD_FLUSH, NULL, 0);
+        }
 
-        if (*window == client->window) {
-            return client;
+        /* Handlers only queue requests, everything goes out here at once */
+        if (flush_batch() <= 0 || xcb_connection_has_error(connection)) {
+            errx(EXIT_FAILURE, "chisai: lost connection to x");
         }
-    }
 
-    return NULL;
-}
+        /*
+         * Flushing reads from the server when the socket backs up, what it
+         * queued is already off the socket and would never wake epoll
+         */
+        if ((event = xcb_poll_for_queued_event(connection))) {
+            handle_event(event);
+            continue;
+        }
 
+        if ((ready = epoll_wait(epoll_fd, events, MAX_EVENTS, -1)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
 
-static void
-forget_window(xcb_window_t window)
-{
-    struct client *client;
-    struct node *node;
+            errx(EXIT_FAILURE, "chisai: failed to wait for events");
+        }
 
-    for (node = window_list->head; node; node = node->next) {
-        client = node->data;
+        for (int i = 0; i < ready; i++) {
+            int fd = events[i].data.fd;
 
-        if (window == client->window) {
-            delete_node(window_list, node);
-            return;
+            if (fd == sock_fd) {
+                /* Pathway for if a client connects */
+                accept_peers();
+            } else if (fd == frame_fd) {
+                /* Pathway for if a dragged window is due for its next frame */
+                uint64_t expirations;
+
+                if (read(frame_fd, &expirations, sizeof(expirations)) > 0) {
+                    run_frame();
+                }
+            } else if (fd == focus_fd) {
+                /* Pathway for if the pointer may have settled on a window */
+                uint64_t expirations;
+
+                if (read(focus_fd, &expirations, sizeof(expirations)) > 0) {
+                    settle_focus();
+                }
+            } else if (fd == config_fd) {
+                /* Pathway for if the config file was written */
+                reload_config();
+            } else if (fd < peers_capacity && peers[fd]) {
+                /* Pathway for if a message from a client is received */
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    read_peer(peers[fd]);
+                } else if (events[i].events & EPOLLOUT) {
+                    /* Drained, carry on with what was read before the output filled up */
+                    if (write_peer(peers[fd]) && !peers[fd]->pending) {
+                        serve_peer(peers[fd]);
+                    }
+                }
+            }
         }
     }
 }
 
 
-static void
-raise_window(xcb_drawable_t window)
+static int
+record_deploy(const char *path)
 {
-    uint32_t values[] = { XCB_STACK_MODE_ABOVE };
+    struct record_setup setup = {
+        .root = screen->root,
+        .id_base = xcb_get_setup(connection)->resource_id_base,
+        .id_mask = xcb_get_setup(connection)->resource_id_mask,
+        .width = screen->width_in_pixels,
+        .height = screen->height_in_pixels,
+        .depth = screen->root_depth,
+    };
 
-    if (!focused_window) {
-        return;
+    if (!(recording = fopen(path, "wb"))) {
+        return -1;
     }
 
-    xcb_configure_window(connection, window,
-            XCB_CONFIG_WINDOW_STACK_MODE, values);
+    fwrite(RECORD_MAGIC, 1, strlen(RECORD_MAGIC), recording);
+    recording_start = now();
 
-    xcb_flush(connection);
+    /* The replay stands in for this connection, so it goes first */
+    record_input(RECORD_SETUP, &setup, sizeof(setup));
+    record_keymap();
+
+    return 0;
 }
 
 
 static void
-close_window(xcb_drawable_t window)
+record_keymap(void)
 {
-    xcb_kill_client(connection, window);
-    forget_window(window);
+    struct record_keymap keymap;
+
+    keymap.min_keycode = min_keycode;
+    keymap.max_keycode = max_keycode;
+    memcpy(keymap.keysyms, keysyms, sizeof(keymap.keysyms));
+    record_input(RECORD_KEYMAP, &keymap, sizeof(keymap));
 }
 
 
-static uint32_t
-get_color(const char *hex)
+static void
+record_input(uint8_t kind, const void *data, uint16_t length)
 {
-    uint32_t rgb48;
-    char strgroups[7] = {
-        hex[1], hex[2], hex[3], hex[4], hex[5], hex[6], '\0'
-    };
+    /* Time since the start, then length and kind, 11 bytes in all */
+    uint64_t time = now() - recording_start;
 
-    rgb48 = strtol(strgroups, NULL, 16);
-    return rgb48 | 0xff000000;
+    fwrite(&time, sizeof(time), 1, recording);
+    fwrite(&length, sizeof(length), 1, recording);
+    fwrite(&kind, sizeof(kind), 1, recording);
+
+    if (length) {
+        fwrite(data, 1, length, recording);
+    }
 }
 
 
 static void
-cleanup(void)
+replay(const char *path)
 {
-    if (connection) {
-        xcb_disconnect(connection);
+    /* Room for full_sequence, which isn't part of what got recorded */
+    xcb_generic_event_t event;
+    xcb_create_notify_event_t *create;
+    char magic[sizeof(RECORD_MAGIC) - 1];
+    char message[BUFSIZ];
+    struct record_setup setup;
+    struct record_keymap keymap;
+    struct record_adopt adopt;
+    struct record_depth *depths = NULL, *grown;
+    size_t depths_length = 0;
+    uint64_t time = 0, start, events = 0, commands = 0;
+    uint16_t length;
+    uint8_t kind;
+    long body;
+    FILE *file;
+
+    if (!(file = fopen(path, "rb"))) {
+        errx(EXIT_FAILURE, "chisai: failed to open %s", path);
     }
-}
 
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic)
+        || memcmp(magic, RECORD_MAGIC, sizeof(magic))) {
+        errx(EXIT_FAILURE, "chisai: %s is not a recorded session", path);
+    }
 
-static int
-socket_deploy(void)
-{
-    struct sockaddr_un sock_addr;
+    /* The connection it was recorded on comes first, the fake takes its place */
+    if (!read_record(file, &kind, &length, &time) || kind != RECORD_SETUP
+        || length != sizeof(setup) || fread(&setup, 1, length, file) != length) {
+        errx(EXIT_FAILURE, "chisai: %s is corrupt", path);
+    }
 
-    /* Get socket path */
-    sock_path = getenv("CHISAI_SOCKET");
-    memset(&sock_addr, 0, sizeof(sock_addr));
+    body = ftell(file);
 
-    if (sock_path) {
-        strncpy(sock_addr.sun_path, sock_path, sizeof(sock_addr.sun_path));
-    } else {
-        strncpy(sock_addr.sun_path, "/tmp/chisai.sock", sizeof(sock_addr.sun_path));
-    }
+    /* Depths are only known once a reply came in, gather them before their windows show up */
+    while (read_record(file, &kind, &length, &time)) {
+        if (kind != RECORD_DEPTH || length != sizeof(*depths)) {
+            if (fseek(file, length, SEEK_CUR) < 0) {
+                break;
+            }
 
-    /* Create socket */
-    if ((sock_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
-        return -1;
-    }
+            continue;
+        }
 
-    sock_addr.sun_family = AF_UNIX;
+        if (!(grown = realloc(depths, (depths_length + 1) * sizeof(*depths)))) {
+            errx(EXIT_FAILURE, "chisai: out of memory");
+        }
 
-    unlink(sock_addr.sun_path);
+        depths = grown;
 
-    /* Bind socket */
-    if (bind(sock_fd, (struct sockaddr*)&sock_addr, sizeof(sock_addr)) < 0) {
-        return -1;
+        if (fread(&depths[depths_length], 1, length, file) != length) {
+            break;
+        }
+
+        depths_length++;
     }
 
-    /* Listen to the socket */
-    if (listen(sock_fd, 1) < 0) {
-        return -1;
+    if (fseek(file, body, SEEK_SET) < 0) {
+        errx(EXIT_FAILURE, "chisai: failed to rewind %s", path);
     }
 
-    return 0;
-}
+    /* Nothing reaches a display, the recorded ids would land on unrelated windows there */
+    backend = &fake_backend;
+    screen = fake_deploy(setup.width, setup.height, setup.depth);
+    fake_replay(setup.root, setup.id_base, setup.id_mask);
 
+    if (timer_deploy() < 0) {
+        errx(EXIT_FAILURE, "chisai: failed to create the timers");
+    }
 
-static int
-x_deploy(void)
-{
-    /* Init XCB and grab events */
-    uint32_t values[2];
-    int mask;
+    start = now();
 
-    /* Make sure XCB and the screen are working properly */
-    if (xcb_connection_has_error(connection = xcb_connect(NULL, NULL))) {
-        return -1;
-    }
+    /* Feed everything straight to the handlers, as fast as they take it */
+    while (read_record(file, &kind, &length, &time)) {
+        if (kind == RECORD_EVENT && length == sizeof(xcb_raw_generic_event_t)) {
+            memset(&event, 0, sizeof(event));
 
-    if (!(screen = xcb_setup_roots_iterator(xcb_get_setup(connection)).data)) {
-        return -1;
-    }
+            if (fread(&event, 1, length, file) != length) {
+                break;
+            }
 
-    /* Grab mouse buttons */
-    xcb_grab_button(connection, 0, screen->root, XCB_EVENT_MASK_BUTTON_PRESS |
-			XCB_EVENT_MASK_BUTTON_RELEASE, XCB_GRAB_MODE_ASYNC,
-			XCB_GRAB_MODE_ASYNC, screen->root, XCB_NONE, 1, MOD);
+            /* After every request sent so far, a zero sequence would be older than all of them and stale */
+            event.full_sequence = newest_sequence;
 
-	xcb_grab_button(connection, 0, screen->root, XCB_EVENT_MASK_BUTTON_PRESS |
-			XCB_EVENT_MASK_BUTTON_RELEASE, XCB_GRAB_MODE_ASYNC,
-            XCB_GRAB_MODE_ASYNC, screen->root, XCB_NONE, 3, MOD);
+            /* The fake answers for the windows it knows, like the server did */
+            if (CLEANMASK(event.response_type) == XCB_CREATE_NOTIFY) {
+                create = (xcb_create_notify_event_t *)&event;
+                fake_add_window(create->window, create->x, create->y,
+                                create->width, create->height,
+                                replayed_depth(depths, depths_length, create->window),
+                                create->override_redirect);
+            }
 
-    /* Update mask and root */
-    mask = XCB_CW_EVENT_MASK;
-    values[0] = XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY;
-	xcb_change_window_attributes_checked(connection, screen->root, mask, values);
+            dispatch_event(&event);
+            events++;
+        } else if (kind == RECORD_COMMAND && length < sizeof(message)) {
+            if (fread(message, 1, length, file) != length) {
+                break;
+            }
 
-    xcb_flush(connection);
+            message[length] = '\0';
+            execute_command(message);
+            commands++;
+        } else if (kind == RECORD_FRAME && !length) {
+            run_frame();
+        } else if (kind == RECORD_FLUSH && !length) {
+            flush_batch();
+        } else if (kind == RECORD_FOCUS && !length) {
+            run_focus();
+        } else if (kind == RECORD_ADOPT && length == sizeof(adopt)) {
+            if (fread(&adopt, 1, length, file) != length) {
+                break;
+            }
 
-    return 0;
+            fake_add_window(adopt.window, adopt.x, adopt.y, adopt.width, adopt.height,
+                            adopt.depth, adopt.override_redirect);
+
+            adopt_window(&adopt);
+        } else if (kind == RECORD_KEYMAP && length == sizeof(keymap)) {
+            if (fread(&keymap, 1, length, file) != length) {
+                break;
+            }
+
+            min_keycode = keymap.min_keycode;
+            max_keycode = keymap.max_keycode;
+            memcpy(keysyms, keymap.keysyms, sizeof(keysyms));
+        } else if (kind == RECORD_DEPTH && length == sizeof(*depths)) {
+            /* Already gathered */
+            if (fseek(file, length, SEEK_CUR) < 0) {
+                break;
+            }
+        } else {
+            errx(EXIT_FAILURE, "chisai: %s is corrupt", path);
+        }
+    }
+
+    /* Count until the server has actually worked through every request */
+    flush_batch();
+    free(xcb_get_input_focus_reply(connection, xcb_get_input_focus(connection), NULL));
+    fclose(file);
+    free(depths);
+
+    fprintf(stderr, "chisai: replayed %llu events and %llu commands, "
+            "%.3fs of session in %.3fs\n",
+            (unsigned long long)events, (unsigned long long)commands,
+            time / 1e9, (now() - start) / 1e9);
 }
 
 
-static void
-load_defaults(void)
+static bool
+read_record(FILE *file, uint8_t *kind, uint16_t *length, uint64_t *time)
 {
-    config.border_side   = BORDER_SIDE;
-    config.border_width  = BORDER_WIDTH;
-    config.focus_color   = get_color(COLOR_FOCUS);
-    config.unfocus_color = get_color(COLOR_UNFOCUS);
-    config.workspaces    = WORKSPACES;
-    config.sloppy_focus  = SLOPPY_FOCUS;
+    /* Time since the start, then length and kind */
+    return fread(time, sizeof(*time), 1, file) && fread(length, sizeof(*length), 1, file)
+           && fread(kind, sizeof(*kind), 1, file);
 }
 
 
-static void
-load_config(void)
+static uint8_t
+replayed_depth(const struct record_depth *depths, size_t length, xcb_window_t window)
 {
-    if (fork() == 0) {
-        execl("${XDG_CONFIG_HOME:-${HOME}/.config}/chisai/chisairc", "chisairc", NULL);
-        exit(EXIT_FAILURE);
+    /* Only clients that needed a frame of their own were recorded, everything else has the root's */
+    for (size_t i = 0; i < length; i++) {
+        if (depths[i].window == window) {
+            return depths[i].depth;
+        }
     }
+
+    return screen->root_depth;
 }
 
 
 static void
-subscribe(struct client *client)
+microbench(uint32_t count)
 {
-    uint32_t values[2] = {
-        XCB_EVENT_MASK_ENTER_WINDOW,
-        XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY
-    };
+    struct client *bench_clients[MICROBENCH_WINDOWS];
+    xcb_create_notify_event_t create = { .response_type = XCB_CREATE_NOTIFY };
+    xcb_map_notify_event_t map = { .response_type = XCB_MAP_NOTIFY };
+    xcb_destroy_notify_event_t destroy = { .response_type = XCB_DESTROY_NOTIFY };
+    xcb_enter_notify_event_t enter = { .response_type = XCB_ENTER_NOTIFY };
+    /* The configure handler reads full_sequence, so that one needs the room */
+    union {
+        xcb_generic_event_t generic;
+        xcb_configure_notify_event_t e;
+    } configure = { .e = { .response_type = XCB_CONFIGURE_NOTIFY } };
+    xcb_button_press_event_t press = { .response_type = XCB_BUTTON_PRESS, .detail = 1 };
+    xcb_motion_notify_event_t motion = { .response_type = XCB_MOTION_NOTIFY };
+    xcb_button_release_event_t release = { .response_type = XCB_BUTTON_RELEASE, .detail = 1 };
+    xcb_key_press_event_t key = { .response_type = XCB_KEY_PRESS, .state = MOD };
+    char theme[64];
+    volatile uint32_t found = 0;
+    struct client *client;
+    xcb_window_t window;
 
-    xcb_change_window_attributes(connection, client->window, XCB_CW_EVENT_MASK, values);
-}
+    /* Every op ends with a flush, like a wakeup of the loop with one event in it */
+    backend = &fake_backend;
+    screen = fake_deploy(1920, 1080, 24);
+    create.parent = screen->root;
+    grab_keys();
 
+    if (timer_deploy() < 0) {
+        errx(EXIT_FAILURE, "chisai: failed to create the timers");
+    }
 
-static void
-focus(struct client *client, int mode)
-{
-    if (mode == ACTIVE){
-        if (!client) {
-            focused_window = NULL;
-            xcb_set_input_focus(connection, XCB_NONE,
-                XCB_INPUT_FOCUS_POINTER_ROOT, XCB_CURRENT_TIME);
-            return;
-        }
+    /* Time the handlers, not the instrumentation */
+    load_defaults();
+    config.stats = false;
+    config.trace = false;
 
-        if (!client->maxed)
-        /* Don't bother focusing root or the window already in focus */
-        if (client->window == focused_window->window || client->window == screen->root) {
-            return;
-        }
+    /* Every window goes through the same events it would on a real server */
+    for (uint32_t i = 0; i < MICROBENCH_WINDOWS; i++) {
+        window = MICROBENCH_ID_BASE + i;
+        fake_add_window(window, i, i, 640, 480, 24, false);
 
-        if (focused_window) {
-            focus(focused_window, INACTIVE);
+        create.window = map.window = window;
+        dispatch_event((xcb_generic_event_t *)&create);
+
+        if (!(bench_clients[i] = find_client(&window))) {
+            errx(EXIT_FAILURE, "chisai: failed to set up the microbenchmark");
         }
 
-        xcb_set_input_focus(connection, XCB_INPUT_FOCUS_POINTER_ROOT,
-            client->window, XCB_CURRENT_TIME);
+        /* Maps only count from inside the frame */
+        map.event = bench_clients[i]->frame;
+        dispatch_event((xcb_generic_event_t *)&map);
+    }
 
-        focused_window = client;
-        set_borders(client, ACTIVE);
-        raise_current_window();
-    } else if (mode == INACTIVE) {
-        if (!focused_window || focused_window->window == screen->root) {
-            return;
-        }
+    flush_batch();
 
-        set_borders(focused_window, INACTIVE);
+    begin_microbench();
+    for (uint32_t i = 0; i < count; i++) {
+        found += find_client(&bench_clients[i % MICROBENCH_WINDOWS]->window) != NULL;
     }
+    end_microbench("find_client", count);
 
-    xcb_flush(connection);
-}
+    begin_microbench();
+    for (uint32_t i = 0; i < count; i++) {
+        focus(bench_clients[i % MICROBENCH_WINDOWS], ACTIVE);
+        flush_batch();
+    }
+    end_microbench("focus", count);
 
+    begin_microbench();
+    for (uint32_t i = 0; i < count; i++) {
+        set_borders(bench_clients[i % MICROBENCH_WINDOWS], i & 1 ? ACTIVE : INACTIVE);
+        flush_batch();
+    }
+    end_microbench("set_borders", count);
+
+    config.sloppy_focus = true;
+    begin_microbench();
+    for (uint32_t i = 0; i < count; i++) {
+        enter.event = bench_clients[i % MICROBENCH_WINDOWS]->frame;
+        dispatch_event((xcb_generic_event_t *)&enter);
+        flush_batch();
+    }
+    end_microbench("enter_notify", count);
 
-static void
-events_loop(void)
-{
+    /* The pointer crossing a row of windows in one wakeup, only the last one is focused */
+    begin_microbench();
+    for (uint32_t i = 0; i < count; i++) {
+        enter.event = bench_clients[i % MICROBENCH_WINDOWS]->frame;
+        dispatch_event((xcb_generic_event_t *)&enter);
 
-    while (true)
-    {
-        /* Select file descriptors and select which one you receive */
-        int x_fd = xcb_get_file_descriptor(connection);
+        if (i % MICROBENCH_SWEEP == MICROBENCH_SWEEP - 1) {
+            flush_batch();
+        }
+    }
+    flush_batch();
+    end_microbench("enter_sweep", count);
+    config.sloppy_focus = SLOPPY_FOCUS;
+
+    begin_microbench();
+    for (uint32_t i = 0; i < count; i++) {
+        /* A move, sent after the server caught up with every request */
+        client = bench_clients[i % MICROBENCH_WINDOWS];
+        configure.e.event = screen->root;
+        configure.e.window = client->frame;
+        configure.e.above_sibling = client->below ? client->below->frame : XCB_NONE;
+        configure.e.x = i & 0xff;
+        configure.e.width = 640;
+        configure.e.height = 480;
+        configure.generic.full_sequence = fake_sequence();
+        dispatch_event(&configure.generic);
+        flush_batch();
+    }
+    end_microbench("configure_notify", count);
+
+    /* A frame for every four motions, about what a fast mouse makes at 60hz */
+    press.child = bench_clients[0]->window;
+    dispatch_event((xcb_generic_event_t *)&press);
+    begin_microbench();
+    for (uint32_t i = 0; i < count; i++) {
+        motion.root_x = 320 + i % 1000;
+        motion.root_y = 240 + i % 500;
+        dispatch_event((xcb_generic_event_t *)&motion);
+
+        if (i % 4 == 3) {
+            run_frame();
+        }
 
-        fd_set file_descriptors;
-        FD_ZERO(&file_descriptors);
-        FD_SET(x_fd, &file_descriptors);
-        FD_SET(sock_fd, &file_descriptors);
+        flush_batch();
+    }
+    end_microbench("motion_notify", count);
+    dispatch_event((xcb_generic_event_t *)&release);
+
+    /* Clicking the window on top, released where the press warped the pointer */
+    release.root_x = bench_clients[0]->x + bench_clients[0]->inner_x + bench_clients[0]->width / 2;
+    release.root_y = bench_clients[0]->y + bench_clients[0]->inner_y + bench_clients[0]->height / 2;
+    begin_microbench();
+    for (uint32_t i = 0; i < count; i++) {
+        dispatch_event((xcb_generic_event_t *)&press);
+        dispatch_event((xcb_generic_event_t *)&release);
+        flush_batch();
+    }
+    end_microbench("click_top", count);
+
+    /* The fake keyboard is printable ASCII from keycode 8, toggle maximize */
+    begin_microbench();
+    for (uint32_t i = 0; i < count; i++) {
+        key.detail = 8 + 'm' - ' ';
+        dispatch_event((xcb_generic_event_t *)&key);
+        flush_batch();
+    }
+    end_microbench("key_press", count);
+
+    /* A theme change, both colors and the side at once, repaints every window in one pass */
+    begin_microbench();
+    for (uint32_t i = 0; i < count / MICROBENCH_WINDOWS + 1; i++) {
+        snprintf(theme, sizeof(theme), "config border_focus #%06x", i & 0xffffff);
+        run_command(theme);
+        snprintf(theme, sizeof(theme), "config border_unfocus #%06x", ~i & 0xffffff);
+        run_command(theme);
+        snprintf(theme, sizeof(theme), "config border_side %s", sides[i & 1 ? LEFT : RIGHT]);
+        run_command(theme);
+        flush_batch();
+    }
+    end_microbench("repaint_borders", count / MICROBENCH_WINDOWS + 1);
 
-        int max_fd = MAX(sock_fd, x_fd) + 1;
+    /* Ids are reused like a server does, so the fake tree doesn't grow */
+    begin_microbench();
+    for (uint32_t i = 0; i < count; i++) {
+        window = MICROBENCH_ID_BASE + MICROBENCH_WINDOWS + i % MICROBENCH_WINDOWS;
+        fake_add_window(window, 0, 0, 640, 480, 24, false);
 
-        if (!(select(max_fd, &file_descriptors, NULL, NULL, NULL) > 0)) {
-			continue;
+        create.window = map.window = destroy.window = window;
+        dispatch_event((xcb_generic_event_t *)&create);
+
+        if ((client = find_client(&window))) {
+            map.event = client->frame;
         }
 
-        /* Pathway for if a message from the client is received */
-        if (FD_ISSET(sock_fd, &file_descriptors)) {
-            char message[BUFSIZ];
-            int message_length;
-            char *command;
+        dispatch_event((xcb_generic_event_t *)&map);
+        dispatch_event((xcb_generic_event_t *)&destroy);
+        flush_batch();
+    } 
+    end_microbench("create_destroy", count);
+
+    /* The same churn from menus and tooltips should cost no requests at all */
+    create.override_redirect = map.override_redirect = true;
+    begin_microbench();
+    for (uint32_t i = 0; i < count; i++) {
+        window = MICROBENCH_ID_BASE + MICROBENCH_WINDOWS + i % MICROBENCH_WINDOWS;
+        fake_add_window(window, 0, 0, 200, 300, 24, true);
+
+        create.window = map.window = destroy.window = window;
+        dispatch_event((xcb_generic_event_t *)&create);
+        dispatch_event((xcb_generic_event_t *)&map);
+        dispatch_event((xcb_generic_event_t *)&destroy);
+        flush_batch();
+    }
+    end_microbench("override_redirect", count);
 
-            if ((client_fd = accept(sock_fd, NULL, 0)) < 0) {
-                errx(EXIT_FAILURE, "chisai: failed to accept client socket");
-            }
+    /* Churn has to come out of the free list, not new slabs */
+    printf("clients live %u peak %u slabs %u\n",
+           client_pool.live, client_pool.peak, client_pool.count);
 
-            if ((message_length = read(client_fd, message, sizeof(message) - 1)) > 0) {
-                message[message_length] = '\0';
-            }
+    fake_cleanup();
+}
 
-            command = strtok(message, " ");
-
-			// TODO: Error Handling
-            if (!strcmp(command, "maximize") == 0) {
-                toggle_maximize_window();
-            } else if (!strcmp(command, "minimize")) {
-                minimize_current_window();
-            } else if (!strcmp(command, "close")) {
-                close_current_window();
-            } else if (!strcmp (command, "resize")) {
-                /* TODO: Resize window */
-            } else if (!strcmp(command, "config")) {
-                command = strtok(NULL, "");
-                if (!strcmp(command, "border_width")) {
-                    command = strtok(NULL, "");
-                    config.border_width = atoi(command);
-                } else if(!strcmp(command, "border_side")) {
-                    enum position side;
-                    command = strtok(NULL, "");
-                    if (!strcmp(command,"all")) {
-                        side = ALL;
-                    } else if (!strcmp(command, "left")) {
-                        side = LEFT;
-                    } else if (!strcmp(command, "right")) {
-                        side = RIGHT;
-                    } else if (!strcmp(command, "top")) {
-                        side = TOP;
-                    } else if (!strcmp(command, "bottom")) {
-                        side = BOTTOM;
-                    } else {
-                        errx(EXIT_FAILURE, "chisai: invalid border side");
-                    }
 
-                    config.border_side = side;
-                }
-            }
-        }
+static void
+begin_microbench(void)
+{
+    microbench_counts = fake_counts;
+    microbench_start = now();
+}
 
-        /* Pathway for if X event is received */
-        if (FD_ISSET(x_fd, &file_descriptors)) {
-            xcb_generic_event_t *event;
-            uint32_t values[3];
-	        xcb_get_geometry_reply_t geometry;
-            struct client client;
 
-            while ((event = xcb_poll_for_event(connection))) {
-                /* Make sure there is an event */
-                if (!event) {
-                    continue;
-                }
+static void
+end_microbench(const char *name, uint32_t ops)
+{
+    uint64_t elapsed;
+    uint64_t requests;
+    const char *opcode;
 
-                /* Handle all the X events we are accepting */
-                switch(CLEANMASK(event->response_type))
-                {
-                    /* Change this to new window because they can just unmap and map windows
-                     * Then handle new windows in the window created event and don't map and then
-                     * in the map event map the window if it can be found 
-                     */
-                    case XCB_CREATE_NOTIFY: {
-                        new_window(event);
-                    } break;
-
-                    case XCB_DESTROY_NOTIFY: {
-                        destroy_window(event);
-                    } break;
-
-                    case XCB_MAP_NOTIFY: {
-                        map_window(event);
-                    } break;
-
-                    case XCB_UNMAP_NOTIFY: {
-                        unmap_window(event);
-                    } break;
-
-                    case XCB_ENTER_NOTIFY: {
-                        enter_window(event);
-                    } break;
-
-                    case XCB_BUTTON_PRESS: {
-                        button_press(event, &client, &geometry, values);
-                    } break;
-
-                    case XCB_MOTION_NOTIFY: {
-                        mouse_motion(&client, &geometry, values);
-                    } break;
-
-                    case XCB_BUTTON_RELEASE: {
-                        button_release(&client);
-                    } break;
-
-                    case XCB_CONFIGURE_NOTIFY: {
-                        configure_window(event);
-                    } break;
-                }
+    /* Whatever the handlers left queued is part of what they cost */
+    flush_batch();
+    elapsed = now() - microbench_start;
 
-                xcb_flush(connection);
-                free(event);
-            }
+    printf("%-18s %10u ops %9.1f ns/op %7.3f requests/op %7.3f replies/op\n",
+           name, ops, (double)elapsed / ops,
+           (double)(fake_counts.requests - microbench_counts.requests) / ops,
+           (double)(fake_counts.replies - microbench_counts.replies) / ops);
+
+    for (int i = 0; i < FAKE_OPCODES; i++) {
+        requests = fake_counts.opcodes[i] - microbench_counts.opcodes[i];
+
+        if (requests && (opcode = fake_opcode_name(i))) {
+            printf("    %-28s %7.3f/op\n", opcode, (double)requests / ops);
         }
     }
 }
 
 
 int
-main(void)
+main(int argc, char *argv[])
 {
+    const char *record_path = NULL, *replay_path = NULL;
+    uint32_t microbench_count = 0;
+    int option;
+
+    /*
+     * -r records the session to a file, -p replays one and exits, -b runs the
+     * handlers against the fake server that many times and exits
+     */
+    while ((option = getopt(argc, argv, "r:p:b:")) != -1) {
+        switch (option) {
+            case 'r': {
+                record_path = optarg;
+            } break;
+
+            case 'p': {
+                replay_path = optarg;
+            } break;
+
+            case 'b': {
+                if (!(microbench_count = strtoul(optarg, NULL, 10))) {
+                    errx(EXIT_FAILURE, "chisai: -b needs a count above 0");
+                }
+            } break;
+
+            default: {
+                errx(EXIT_FAILURE, "usage: %s [-r record_file | -p replay_file | -b count]", argv[0]);
+            }
+        }
+    }
+
     /* Cleanup X Connections */
     atexit(cleanup);
 
+    /* Nothing but the handlers and the fake */
+    if (microbench_count) {
+        microbench(microbench_count);
+
+        return EXIT_SUCCESS;
+    }
+
+    /* A replay runs against the fake, neither X nor the live socket are touched */
+    if (replay_path) {
+        load_defaults();
+        replay(replay_path);
+
+        return EXIT_SUCCESS;
+    }
+
     /* Setup socket and X */
     if (socket_deploy() < 0) {
         errx(EXIT_FAILURE, "chisai: error connecting to socket");
@@ -972,8 +4076,21 @@ main(void)
         errx(EXIT_FAILURE, "chisai: error connecting to x");
     }
 
+    if (record_path && record_deploy(record_path) < 0) {
+        errx(EXIT_FAILURE, "chisai: error opening %s", record_path);
+    }
+
+    /* Nothing waits on autostarted programs, they are left to init */
+    signal(SIGCHLD, SIG_IGN);
+
     load_defaults();
     load_config();
+    adopt_windows();
+    autostart();
+
+    if (loop_deploy() < 0) {
+        errx(EXIT_FAILURE, "chisai: error setting up the event loop");
+    }
 
     events_loop();
 
@@ -17,4 +17,35 @@
 /* focus windows after hovering them with the pointer */
 #define SLOPPY_FOCUS false
 
+/* Milliseconds sloppy focus waits for the pointer to settle, 0 focuses once per batch of events */
+#define FOCUS_DELAY 0
+
+/* Times per second a dragged window is moved or resized, can be changed with maikuro */
+#define REFRESH_RATE 60
+
+/* Time every event and command for maikuro stats, can be changed with maikuro */
+#define STATS false
+
+/* Keep a trace of recent events for maikuro trace dump, can be changed with maikuro */
+#define TRACE true
+
+/*
+ * Keys - Modifiers, key and the command it runs, the same commands maikuro sends.
+ * Plain characters are their own keysym, like '1' or 'a'
+ */
+#define KEYS \
+    { MOD,         '1', "workspace 1" }, \
+    { MOD,         '2', "workspace 2" }, \
+    { MOD,         '3', "workspace 3" }, \
+    { MOD,         '4', "workspace 4" }, \
+    { MOD,         '5', "workspace 5" }, \
+    { MOD | SHIFT, 'w', "config border_side top" }, \
+    { MOD | SHIFT, 'a', "config border_side left" }, \
+    { MOD | SHIFT, 's', "config border_side bottom" }, \
+    { MOD | SHIFT, 'd', "config border_side right" }, \
+    { MOD | SHIFT, 'e', "config border_side all" }, \
+    { MOD,         'q', "close" }, \
+    { MOD,         'm', "maximize" }, \
+    { MOD,         'n', "minimize" },
+
 #endif
@@ -0,0 +1,1040 @@
+/* Chisai Fake - In-memory X server the handlers can be benchmarked against */
+/* Includes */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <xcb/xcb.h>
+
+#include "fake.h"
+
+/* Macros */
+#define ROOT 0x00000100
+
+/* Window table sizing, capacity must stay a power of two */
+#define WINDOWS_MIN_CAPACITY 64
+
+/* Replies that can be outstanding at once, must be a power of two */
+#define PENDING_SIZE 4096
+
+/* Destroyed ids of the fake's own kept for reuse, so frame churn doesn't grow the table */
+#define RECYCLED_SIZE 1024
+
+/*
+ * Struct: fake_window
+ * -------------------
+ * Window of the simulated tree, a child of the root or of a frame
+ *
+ * id                 - The window, XCB_NONE for an empty slot
+ * parent             - Window it is a child of
+ * x, y               - Position
+ * width, height      - Size
+ * border_width       - Width of the border
+ * depth              - Depth
+ * override_redirect  - Whether the window asked not to be managed
+ * mapped             - Whether the window is mapped
+ * alive              - Whether the window still exists, slots are never emptied
+ * stacked            - Place in the stacking order, higher is on top
+ */
+struct fake_window {
+    xcb_window_t id;
+    xcb_window_t parent;
+    int16_t x, y;
+    uint16_t width, height;
+    uint16_t border_width;
+    uint8_t depth;
+    bool override_redirect;
+    bool mapped;
+    bool alive;
+    int64_t stacked;
+};
+
+/*
+ * Struct: fake_pending
+ * --------------------
+ * Request whose reply hasn't been asked for yet
+ *
+ * sequence  - Sequence number of the request
+ * window    - Window the reply is about
+ */
+struct fake_pending {
+    uint32_t sequence;
+    xcb_window_t window;
+};
+
+/*
+ * Struct: fake_display
+ * --------------------
+ * Screen laid out the way the connection setup has it, the depths it lists
+ * right behind it
+ *
+ * screen  - The screen
+ * depth   - Depth there is a visual for besides the root depth, 32 for ARGB
+ * visual  - TrueColor visual of that depth
+ */
+struct fake_display {
+    xcb_screen_t screen;
+    xcb_depth_t depth;
+    xcb_visualtype_t visual;
+};
+
+/* Variables */
+struct fake_counts fake_counts;
+
+static struct fake_window *windows;
+static uint32_t windows_capacity, windows_length;
+static struct fake_pending pending[PENDING_SIZE];
+static struct fake_display display;
+static xcb_window_t input_focus;
+static uint32_t sequence;
+static uint32_t next_id;
+static uint32_t id_base, id_step, id_last;
+static xcb_window_t recycled[RECYCLED_SIZE];
+static uint32_t recycled_length;
+static int64_t stacking;
+
+/* Tree Functions */
+static struct fake_window* find_window(xcb_window_t id);
+static struct fake_window* insert_window(xcb_window_t id);
+static bool grow_windows(void);
+static int compare_stacking(const void *a, const void *b);
+
+/* Request Functions */
+static xcb_void_cookie_t count(uint8_t opcode);
+static uint32_t remember(uint8_t opcode, xcb_window_t window);
+static xcb_window_t recall(uint32_t sequence, xcb_generic_error_t **e);
+
+/* Backend Functions */
+static xcb_void_cookie_t change_save_set(xcb_connection_t *c, uint8_t mode, xcb_window_t window);
+static xcb_void_cookie_t change_window_attributes(xcb_connection_t *c, xcb_window_t window, uint32_t mask, const void *values);
+static xcb_void_cookie_t clear_area(xcb_connection_t *c, uint8_t exposures, xcb_window_t window, int16_t x, int16_t y, uint16_t width, uint16_t height);
+static xcb_void_cookie_t configure_window(xcb_connection_t *c, xcb_window_t window, uint16_t mask, const void *values);
+static xcb_void_cookie_t create_colormap(xcb_connection_t *c, uint8_t alloc, xcb_colormap_t mid, xcb_window_t window, xcb_visualid_t visual);
+static xcb_void_cookie_t create_window(xcb_connection_t *c, uint8_t depth, xcb_window_t wid, xcb_window_t parent, int16_t x, int16_t y, uint16_t width, uint16_t height, uint16_t border_width, uint16_t _class, xcb_visualid_t visual, uint32_t value_mask, const void *value_list);
+static xcb_void_cookie_t destroy_window(xcb_connection_t *c, xcb_window_t window);
+static xcb_get_geometry_cookie_t get_geometry(xcb_connection_t *c, xcb_drawable_t drawable);
+static xcb_get_input_focus_cookie_t get_input_focus(xcb_connection_t *c);
+static xcb_get_keyboard_mapping_cookie_t get_keyboard_mapping(xcb_connection_t *c, xcb_keycode_t first_keycode, uint8_t count);
+static xcb_get_window_attributes_cookie_t get_window_attributes(xcb_connection_t *c, xcb_window_t window);
+static xcb_void_cookie_t grab_button(xcb_connection_t *c, uint8_t owner_events, xcb_window_t window, uint16_t event_mask, uint8_t pointer_mode, uint8_t keyboard_mode, xcb_window_t confine_to, xcb_cursor_t cursor, uint8_t button, uint16_t modifiers);
+static xcb_void_cookie_t grab_key(xcb_connection_t *c, uint8_t owner_events, xcb_window_t window, uint16_t modifiers, xcb_keycode_t key, uint8_t pointer_mode, uint8_t keyboard_mode);
+static xcb_grab_pointer_cookie_t grab_pointer(xcb_connection_t *c, uint8_t owner_events, xcb_window_t window, uint16_t event_mask, uint8_t pointer_mode, uint8_t keyboard_mode, xcb_window_t confine_to, xcb_cursor_t cursor, xcb_timestamp_t time);
+static xcb_void_cookie_t kill_client(xcb_connection_t *c, uint32_t resource);
+static xcb_void_cookie_t map_window(xcb_connection_t *c, xcb_window_t window);
+static xcb_query_tree_cookie_t query_tree(xcb_connection_t *c, xcb_window_t window);
+static xcb_void_cookie_t reparent_window(xcb_connection_t *c, xcb_window_t window, xcb_window_t parent, int16_t x, int16_t y);
+static xcb_void_cookie_t send_event(xcb_connection_t *c, uint8_t propagate, xcb_window_t destination, uint32_t event_mask, const char *event);
+static xcb_void_cookie_t set_input_focus(xcb_connection_t *c, uint8_t revert_to, xcb_window_t focus, xcb_timestamp_t time);
+static xcb_void_cookie_t ungrab_key(xcb_connection_t *c, xcb_keycode_t key, xcb_window_t window, uint16_t modifiers);
+static xcb_void_cookie_t ungrab_pointer(xcb_connection_t *c, xcb_timestamp_t time);
+static xcb_void_cookie_t unmap_window(xcb_connection_t *c, xcb_window_t window);
+static xcb_void_cookie_t warp_pointer(xcb_connection_t *c, xcb_window_t src_window, xcb_window_t dst_window, int16_t src_x, int16_t src_y, uint16_t src_width, uint16_t src_height, int16_t dst_x, int16_t dst_y);
+static xcb_get_geometry_reply_t* get_geometry_reply(xcb_connection_t *c, xcb_get_geometry_cookie_t cookie, xcb_generic_error_t **e);
+static xcb_get_input_focus_reply_t* get_input_focus_reply(xcb_connection_t *c, xcb_get_input_focus_cookie_t cookie, xcb_generic_error_t **e);
+static xcb_get_keyboard_mapping_reply_t* get_keyboard_mapping_reply(xcb_connection_t *c, xcb_get_keyboard_mapping_cookie_t cookie, xcb_generic_error_t **e);
+static xcb_get_window_attributes_reply_t* get_window_attributes_reply(xcb_connection_t *c, xcb_get_window_attributes_cookie_t cookie, xcb_generic_error_t **e);
+static xcb_query_tree_reply_t* query_tree_reply(xcb_connection_t *c, xcb_query_tree_cookie_t cookie, xcb_generic_error_t **e);
+static int flush(xcb_connection_t *c);
+static uint32_t generate_id(xcb_connection_t *c);
+static xcb_generic_event_t* poll_for_event(xcb_connection_t *c);
+static void discard_reply(xcb_connection_t *c, unsigned int sequence);
+static int connection_has_error(xcb_connection_t *c);
+
+/* Backend - Checked and unchecked requests are the same thing to the fake */
+const struct backend fake_backend = {
+    .change_save_set                  = change_save_set,
+    .change_window_attributes         = change_window_attributes,
+    .change_window_attributes_checked = change_window_attributes,
+    .clear_area                       = clear_area,
+    .configure_window                 = configure_window,
+    .create_colormap                  = create_colormap,
+    .create_window                    = create_window,
+    .destroy_window                   = destroy_window,
+    .get_geometry                     = get_geometry,
+    .get_input_focus                  = get_input_focus,
+    .get_keyboard_mapping             = get_keyboard_mapping,
+    .get_window_attributes            = get_window_attributes,
+    .grab_button                      = grab_button,
+    .grab_key                         = grab_key,
+    .grab_pointer                     = grab_pointer,
+    .kill_client                      = kill_client,
+    .map_window                       = map_window,
+    .query_tree                       = query_tree,
+    .reparent_window                  = reparent_window,
+    .send_event                       = send_event,
+    .set_input_focus                  = set_input_focus,
+    .ungrab_key                       = ungrab_key,
+    .ungrab_pointer                   = ungrab_pointer,
+    .unmap_window                     = unmap_window,
+    .warp_pointer                     = warp_pointer,
+    .get_geometry_reply               = get_geometry_reply,
+    .get_input_focus_reply            = get_input_focus_reply,
+    .get_keyboard_mapping_reply       = get_keyboard_mapping_reply,
+    .get_window_attributes_reply      = get_window_attributes_reply,
+    .query_tree_reply                 = query_tree_reply,
+    .flush                            = flush,
+    .generate_id                      = generate_id,
+    .poll_for_event                   = poll_for_event,
+    .poll_for_queued_event            = poll_for_event,
+    .discard_reply                    = discard_reply,
+    .connection_has_error             = connection_has_error,
+};
+
+
+/*
+ * Function: fake_deploy
+ * ---------------------
+ * Starts the fake server over with an empty root window
+ *
+ * width:  Width of the screen
+ * height: Height of the screen
+ * depth:  Depth of the root window
+ *
+ * returns: the screen, standing in for the one in the connection setup
+ */
+xcb_screen_t*
+fake_deploy(uint16_t width, uint16_t height, uint8_t depth)
+{
+    fake_cleanup();
+
+    memset(&display, 0, sizeof(display));
+    display.screen.root = ROOT;
+    display.screen.width_in_pixels = width;
+    display.screen.height_in_pixels = height;
+    display.screen.root_depth = depth;
+    display.screen.root_visual = ROOT + 1;
+
+    /* Frames of ARGB clients need a visual of their depth, the rest share the root's */
+    display.screen.allowed_depths_len = depth != 32;
+    display.depth.depth = 32;
+    display.depth.visuals_len = 1;
+    display.visual.visual_id = ROOT + 2;
+    display.visual._class = XCB_VISUAL_CLASS_TRUE_COLOR;
+    display.visual.bits_per_rgb_value = 8;
+    display.visual.colormap_entries = 256;
+    display.visual.red_mask = 0xff0000;
+    display.visual.green_mask = 0x00ff00;
+    display.visual.blue_mask = 0x0000ff;
+
+    memset(&fake_counts, 0, sizeof(fake_counts));
+    memset(pending, 0, sizeof(pending));
+    input_focus = XCB_NONE;
+    sequence = 0;
+    next_id = FAKE_ID_BASE;
+    id_step = 0;
+    recycled_length = 0;
+    stacking = 0;
+
+    return &display.screen;
+}
+
+
+/*
+ * Function: fake_replay
+ * ---------------------
+ * Takes on the root and the ids of a recorded connection, so the ids chisai
+ * generates match the ones the recorded events carry
+ *
+ * root:     Root window of the recording
+ * base:     Resource id base of the recorded connection
+ * mask:     Resource id mask of the recorded connection
+ *
+ * returns: nothing
+ */
+void
+fake_replay(xcb_window_t root, uint32_t base, uint32_t mask)
+{
+    display.screen.root = root;
+
+    /* Counted up from the base like libxcb does, and never handed out twice */
+    id_base = base;
+    id_step = mask & -mask;
+    id_last = 0;
+}
+
+
+/*
+ * Function: fake_cleanup
+ * ----------------------
+ * Forgets every window of the simulated tree
+ *
+ * returns: nothing
+ */
+void
+fake_cleanup(void)
+{
+    free(windows);
+    windows = NULL;
+    windows_capacity = 0;
+    windows_length = 0;
+}
+
+
+/*
+ * Function: fake_add_window
+ * -------------------------
+ * Creates a window on top of the others, what a client would do before the
+ * CreateNotify reaches chisai. An id that was destroyed comes back to life.
+ *
+ * window:            The window
+ * x, y:              Position
+ * width, height:     Size
+ * depth:             Depth
+ * override_redirect: Whether the window asks not to be managed
+ *
+ * returns: nothing
+ */
+void
+fake_add_window(xcb_window_t window, int16_t x, int16_t y, uint16_t width,
+                uint16_t height, uint8_t depth, bool override_redirect)
+{
+    struct fake_window *fake;
+
+    if (!(fake = insert_window(window))) {
+        return;
+    }
+
+    fake->parent = display.screen.root;
+    fake->x = x;
+    fake->y = y;
+    fake->width = width;
+    fake->height = height;
+    fake->border_width = 0;
+    fake->depth = depth;
+    fake->override_redirect = override_redirect;
+    fake->mapped = false;
+    fake->alive = true;
+    fake->stacked = ++stacking;
+}
+
+
+/*
+ * Function: fake_opcode_name
+ * --------------------------
+ * Names a request chisai sends
+ *
+ * opcode: Major opcode of the request
+ *
+ * returns: the name, or NULL for a request chisai doesn't send
+ */
+const char*
+fake_opcode_name(uint8_t opcode)
+{
+    switch (opcode) {
+        case XCB_CREATE_WINDOW:            return "create_window";
+        case XCB_CHANGE_WINDOW_ATTRIBUTES: return "change_window_attributes";
+        case XCB_GET_WINDOW_ATTRIBUTES:    return "get_window_attributes";
+        case XCB_DESTROY_WINDOW:           return "destroy_window";
+        case XCB_CHANGE_SAVE_SET:          return "change_save_set";
+        case XCB_REPARENT_WINDOW:          return "reparent_window";
+        case XCB_MAP_WINDOW:               return "map_window";
+        case XCB_UNMAP_WINDOW:             return "unmap_window";
+        case XCB_CONFIGURE_WINDOW:         return "configure_window";
+        case XCB_GET_GEOMETRY:             return "get_geometry";
+        case XCB_QUERY_TREE:               return "query_tree";
+        case XCB_GRAB_POINTER:             return "grab_pointer";
+        case XCB_UNGRAB_POINTER:           return "ungrab_pointer";
+        case XCB_GRAB_BUTTON:              return "grab_button";
+        case XCB_GRAB_KEY:                 return "grab_key";
+        case XCB_UNGRAB_KEY:               return "ungrab_key";
+        case XCB_GET_KEYBOARD_MAPPING:     return "get_keyboard_mapping";
+        case XCB_WARP_POINTER:             return "warp_pointer";
+        case XCB_SET_INPUT_FOCUS:          return "set_input_focus";
+        case XCB_GET_INPUT_FOCUS:          return "get_input_focus";
+        case XCB_CLEAR_AREA:               return "clear_area";
+        case XCB_CREATE_COLORMAP:          return "create_colormap";
+        case XCB_SEND_EVENT:               return "send_event";
+        case XCB_KILL_CLIENT:              return "kill_client";
+        default:                           return NULL;
+    }
+}
+
+
+/*
+ * Function: fake_sequence
+ * -----------------------
+ * Sequence of the last request, what an event sent right now would carry
+ *
+ * returns: the sequence
+ */
+uint32_t
+fake_sequence(void)
+{
+    return sequence;
+}
+
+
+static struct fake_window*
+find_window(xcb_window_t id)
+{
+    uint32_t i;
+
+    if (!windows_capacity) {
+        return NULL;
+    }
+
+    for (i = WINDOW_HASH(id, windows_capacity); windows[i].id; i = (i + 1) & (windows_capacity - 1)) {
+        if (windows[i].id == id) {
+            return windows[i].alive ? &windows[i] : NULL;
+        }
+    }
+
+    return NULL;
+}
+
+
+static struct fake_window*
+insert_window(xcb_window_t id)
+{
+    uint32_t i;
+
+    /* Keep at least half the slots empty so probes stay short */
+    if ((windows_length + 1) * 2 > windows_capacity && !grow_windows()) {
+        return NULL;
+    }
+
+    for (i = WINDOW_HASH(id, windows_capacity); windows[i].id; i = (i + 1) & (windows_capacity - 1)) {
+        if (windows[i].id == id) {
+            return &windows[i];
+        }
+    }
+
+    windows[i].id = id;
+    windows_length++;
+
+    return &windows[i];
+}
+
+
+static bool
+grow_windows(void)
+{
+    struct fake_window *old = windows;
+    uint32_t capacity = windows_capacity;
+    uint32_t i;
+
+    windows_capacity = capacity ? capacity * 2 : WINDOWS_MIN_CAPACITY;
+
+    if (!(windows = calloc(windows_capacity, sizeof(struct fake_window)))) {
+        windows = old;
+        windows_capacity = capacity;
+        return false;
+    }
+
+    for (uint32_t j = 0; j < capacity; j++) {
+        if (!old[j].id) {
+            continue;
+        }
+
+        for (i = WINDOW_HASH(old[j].id, windows_capacity); windows[i].id; i = (i + 1) & (windows_capacity - 1));
+        windows[i] = old[j];
+    }
+
+    free(old);
+
+    return true;
+}
+
+
+static int
+compare_stacking(const void *a, const void *b)
+{
+    const struct fake_window *first = *(struct fake_window * const *)a;
+    const struct fake_window *second = *(struct fake_window * const *)b;
+
+    return (first->stacked > second->stacked) - (first->stacked < second->stacked);
+}
+
+
+static xcb_void_cookie_t
+count(uint8_t opcode)
+{
+    xcb_void_cookie_t cookie;
+
+    /* Sequence 0 means no pending request everywhere in chisai, skip it */
+    if (!++sequence) {
+        sequence++;
+    }
+
+    cookie.sequence = sequence;
+    fake_counts.requests++;
+    fake_counts.opcodes[opcode & (FAKE_OPCODES - 1)]++;
+
+    return cookie;
+}
+
+
+static uint32_t
+remember(uint8_t opcode, xcb_window_t window)
+{
+    struct fake_pending *entry;
+
+    count(opcode);
+    entry = &pending[sequence & (PENDING_SIZE - 1)];
+    entry->sequence = sequence;
+    entry->window = window;
+
+    return sequence;
+}
+
+
+static xcb_window_t
+recall(uint32_t sequence, xcb_generic_error_t **e)
+{
+    struct fake_pending *entry = &pending[sequence & (PENDING_SIZE - 1)];
+    xcb_window_t window = XCB_NONE;
+
+    fake_counts.replies++;
+
+    if (e) {
+        *e = NULL;
+    }
+
+    /* Too many requests since, the reply fell out of the ring */
+    if (entry->sequence == sequence) {
+        window = entry->window;
+        entry->sequence = 0;
+    }
+
+    return window;
+}
+
+
+static xcb_void_cookie_t
+change_save_set(xcb_connection_t *c, uint8_t mode, xcb_window_t window)
+{
+    (void)c; (void)mode; (void)window;
+    return count(XCB_CHANGE_SAVE_SET);
+}
+
+
+static xcb_void_cookie_t
+change_window_attributes(xcb_connection_t *c, xcb_window_t window, uint32_t mask, const void *values)
+{
+    (void)c; (void)window; (void)mask; (void)values;
+    return count(XCB_CHANGE_WINDOW_ATTRIBUTES);
+}
+
+
+static xcb_void_cookie_t
+clear_area(xcb_connection_t *c, uint8_t exposures, xcb_window_t window,
+           int16_t x, int16_t y, uint16_t width, uint16_t height)
+{
+    (void)c; (void)exposures; (void)window; (void)x; (void)y; (void)width; (void)height;
+    return count(XCB_CLEAR_AREA);
+}
+
+
+static xcb_void_cookie_t
+configure_window(xcb_connection_t *c, xcb_window_t window, uint16_t mask, const void *values)
+{
+    struct fake_window *fake;
+    const uint32_t *value = values;
+
+    (void)c;
+
+    if (!(fake = find_window(window))) {
+        return count(XCB_CONFIGURE_WINDOW);
+    }
+
+    /* Values come in the order of the mask bits */
+    if (mask & XCB_CONFIG_WINDOW_X) {
+        fake->x = *value++;
+    }
+    if (mask & XCB_CONFIG_WINDOW_Y) {
+        fake->y = *value++;
+    }
+    if (mask & XCB_CONFIG_WINDOW_WIDTH) {
+        fake->width = *value++;
+    }
+    if (mask & XCB_CONFIG_WINDOW_HEIGHT) {
+        fake->height = *value++;
+    }
+    if (mask & XCB_CONFIG_WINDOW_BORDER_WIDTH) {
+        fake->border_width = *value++;
+    }
+    if (mask & XCB_CONFIG_WINDOW_SIBLING) {
+        value++;
+    }
+    if (mask & XCB_CONFIG_WINDOW_STACK_MODE) {
+        if (*value == XCB_STACK_MODE_ABOVE) {
+            fake->stacked = ++stacking;
+        } else if (*value == XCB_STACK_MODE_BELOW) {
+            fake->stacked = -++stacking;
+        }
+    }
+
+    return count(XCB_CONFIGURE_WINDOW);
+}
+
+
+static xcb_void_cookie_t
+create_colormap(xcb_connection_t *c, uint8_t alloc, xcb_colormap_t mid, xcb_window_t window, xcb_visualid_t visual)
+{
+    (void)c; (void)alloc; (void)mid; (void)window; (void)visual;
+    return count(XCB_CREATE_COLORMAP);
+}
+
+
+static xcb_void_cookie_t
+create_window(xcb_connection_t *c, uint8_t depth, xcb_window_t wid, xcb_window_t parent,
+              int16_t x, int16_t y, uint16_t width, uint16_t height, uint16_t border_width,
+              uint16_t _class, xcb_visualid_t visual, uint32_t value_mask, const void *value_list)
+{
+    struct fake_window *fake;
+
+    (void)c; (void)_class; (void)visual; (void)value_mask; (void)value_list;
+
+    /* Goes on top of its siblings, unmapped, like on a real server */
+    if ((fake = insert_window(wid))) {
+        fake->parent = parent;
+        fake->x = x;
+        fake->y = y;
+        fake->width = width;
+        fake->height = height;
+        fake->border_width = border_width;
+        fake->depth = depth ? depth : display.screen.root_depth;
+        fake->override_redirect = false;
+        fake->mapped = false;
+        fake->alive = true;
+        fake->stacked = ++stacking;
+    }
+
+    return count(XCB_CREATE_WINDOW);
+}
+
+
+static xcb_void_cookie_t
+destroy_window(xcb_connection_t *c, xcb_window_t window)
+{
+    struct fake_window *fake;
+
+    (void)c;
+
+    /* Children are left alone, chisai only destroys frames whose client is already gone */
+    if ((fake = find_window(window))) {
+        fake->alive = false;
+        fake->mapped = false;
+
+        if (!id_step && window >= FAKE_ID_BASE && recycled_length < RECYCLED_SIZE) {
+            recycled[recycled_length++] = window;
+        }
+    }
+
+    return count(XCB_DESTROY_WINDOW);
+}
+
+
+static xcb_get_geometry_cookie_t
+get_geometry(xcb_connection_t *c, xcb_drawable_t drawable)
+{
+    xcb_get_geometry_cookie_t cookie = { remember(XCB_GET_GEOMETRY, drawable) };
+
+    (void)c;
+    return cookie;
+}
+
+
+static xcb_get_input_focus_cookie_t
+get_input_focus(xcb_connection_t *c)
+{
+    xcb_get_input_focus_cookie_t cookie = { remember(XCB_GET_INPUT_FOCUS, XCB_NONE) };
+
+    (void)c;
+    return cookie;
+}
+
+
+static xcb_get_keyboard_mapping_cookie_t
+get_keyboard_mapping(xcb_connection_t *c, xcb_keycode_t first_keycode, uint8_t count)
+{
+    /* No window to remember, the range fits where it would go */
+    xcb_get_keyboard_mapping_cookie_t cookie = {
+        remember(XCB_GET_KEYBOARD_MAPPING, first_keycode << 8 | count)
+    };
+
+    (void)c;
+    return cookie;
+}
+
+
+static xcb_get_window_attributes_cookie_t
+get_window_attributes(xcb_connection_t *c, xcb_window_t window)
+{
+    xcb_get_window_attributes_cookie_t cookie = { remember(XCB_GET_WINDOW_ATTRIBUTES, window) };
+
+    (void)c;
+    return cookie;
+}
+
+
+static xcb_void_cookie_t
+grab_button(xcb_connection_t *c, uint8_t owner_events, xcb_window_t window, uint16_t event_mask,
+            uint8_t pointer_mode, uint8_t keyboard_mode, xcb_window_t confine_to,
+            xcb_cursor_t cursor, uint8_t button, uint16_t modifiers)
+{
+    (void)c; (void)owner_events; (void)window; (void)event_mask; (void)pointer_mode;
+    (void)keyboard_mode; (void)confine_to; (void)cursor; (void)button; (void)modifiers;
+    return count(XCB_GRAB_BUTTON);
+}
+
+
+static xcb_void_cookie_t
+grab_key(xcb_connection_t *c, uint8_t owner_events, xcb_window_t window, uint16_t modifiers,
+         xcb_keycode_t key, uint8_t pointer_mode, uint8_t keyboard_mode)
+{
+    (void)c; (void)owner_events; (void)window; (void)modifiers; (void)key;
+    (void)pointer_mode; (void)keyboard_mode;
+    return count(XCB_GRAB_KEY);
+}
+
+
+static xcb_grab_pointer_cookie_t
+grab_pointer(xcb_connection_t *c, uint8_t owner_events, xcb_window_t window, uint16_t event_mask,
+             uint8_t pointer_mode, uint8_t keyboard_mode, xcb_window_t confine_to,
+             xcb_cursor_t cursor, xcb_timestamp_t time)
+{
+    xcb_grab_pointer_cookie_t cookie = { remember(XCB_GRAB_POINTER, window) };
+
+    (void)c; (void)owner_events; (void)event_mask; (void)pointer_mode;
+    (void)keyboard_mode; (void)confine_to; (void)cursor; (void)time;
+    return cookie;
+}
+
+
+static xcb_void_cookie_t
+kill_client(xcb_connection_t *c, uint32_t resource)
+{
+    struct fake_window *fake;
+
+    (void)c;
+
+    /* Every fake window is its own client, killing it destroys it */
+    if ((fake = find_window(resource))) {
+        fake->alive = false;
+        fake->mapped = false;
+    }
+
+    return count(XCB_KILL_CLIENT);
+}
+
+
+static xcb_void_cookie_t
+map_window(xcb_connection_t *c, xcb_window_t window)
+{
+    struct fake_window *fake;
+
+    (void)c;
+
+    if ((fake = find_window(window))) {
+        fake->mapped = true;
+    }
+
+    return count(XCB_MAP_WINDOW);
+}
+
+
+
+
+static xcb_query_tree_cookie_t
+query_tree(xcb_connection_t *c, xcb_window_t window)
+{
+    xcb_query_tree_cookie_t cookie = { remember(XCB_QUERY_TREE, window) };
+
+    (void)c;
+    return cookie;
+}
+
+
+static xcb_void_cookie_t
+reparent_window(xcb_connection_t *c, xcb_window_t window, xcb_window_t parent, int16_t x, int16_t y)
+{
+    struct fake_window *fake;
+
+    (void)c;
+
+    if ((fake = find_window(window))) {
+        fake->parent = parent;
+        fake->x = x;
+        fake->y = y;
+        fake->stacked = ++stacking;
+    }
+
+    return count(XCB_REPARENT_WINDOW);
+}
+
+
+static xcb_void_cookie_t
+send_event(xcb_connection_t *c, uint8_t propagate, xcb_window_t destination, uint32_t event_mask, const char *event)
+{
+    (void)c; (void)propagate; (void)destination; (void)event_mask; (void)event;
+    return count(XCB_SEND_EVENT);
+}
+
+
+static xcb_void_cookie_t
+set_input_focus(xcb_connection_t *c, uint8_t revert_to, xcb_window_t focus, xcb_timestamp_t time)
+{
+    (void)c; (void)revert_to; (void)time;
+
+    input_focus = focus;
+    return count(XCB_SET_INPUT_FOCUS);
+}
+
+
+static xcb_void_cookie_t
+ungrab_key(xcb_connection_t *c, xcb_keycode_t key, xcb_window_t window, uint16_t modifiers)
+{
+    (void)c; (void)key; (void)window; (void)modifiers;
+    return count(XCB_UNGRAB_KEY);
+}
+
+
+static xcb_void_cookie_t
+ungrab_pointer(xcb_connection_t *c, xcb_timestamp_t time)
+{
+    (void)c; (void)time;
+    return count(XCB_UNGRAB_POINTER);
+}
+
+
+static xcb_void_cookie_t
+unmap_window(xcb_connection_t *c, xcb_window_t window)
+{
+    struct fake_window *fake;
+
+    (void)c;
+
+    if ((fake = find_window(window))) {
+        fake->mapped = false;
+    }
+
+    return count(XCB_UNMAP_WINDOW);
+}
+
+
+static xcb_void_cookie_t
+warp_pointer(xcb_connection_t *c, xcb_window_t src_window, xcb_window_t dst_window,
+             int16_t src_x, int16_t src_y, uint16_t src_width, uint16_t src_height,
+             int16_t dst_x, int16_t dst_y)
+{
+    (void)c; (void)src_window; (void)dst_window; (void)src_x; (void)src_y;
+    (void)src_width; (void)src_height; (void)dst_x; (void)dst_y;
+    return count(XCB_WARP_POINTER);
+}
+
+
+static xcb_get_geometry_reply_t*
+get_geometry_reply(xcb_connection_t *c, xcb_get_geometry_cookie_t cookie, xcb_generic_error_t **e)
+{
+    xcb_window_t window = recall(cookie.sequence, e);
+    xcb_get_geometry_reply_t *reply;
+    struct fake_window *fake = NULL;
+
+    (void)c;
+
+    /* A window that is gone gets an error, which is no reply to the caller */
+    if (window != display.screen.root && !(fake = find_window(window))) {
+        return NULL;
+    }
+
+    if (!(reply = calloc(1, sizeof(xcb_get_geometry_reply_t)))) {
+        return NULL;
+    }
+
+    reply->response_type = XCB_GET_GEOMETRY;
+    reply->sequence = cookie.sequence;
+    reply->root = display.screen.root;
+
+    if (fake) {
+        reply->depth = fake->depth;
+        reply->x = fake->x;
+        reply->y = fake->y;
+        reply->width = fake->width;
+        reply->height = fake->height;
+        reply->border_width = fake->border_width;
+    } else {
+        reply->depth = display.screen.root_depth;
+        reply->width = display.screen.width_in_pixels;
+        reply->height = display.screen.height_in_pixels;
+    }
+
+    return reply;
+}
+
+
+static xcb_get_input_focus_reply_t*
+get_input_focus_reply(xcb_connection_t *c, xcb_get_input_focus_cookie_t cookie, xcb_generic_error_t **e)
+{
+    xcb_get_input_focus_reply_t *reply;
+
+    (void)c;
+    recall(cookie.sequence, e);
+
+    if (!(reply = calloc(1, sizeof(xcb_get_input_focus_reply_t)))) {
+        return NULL;
+    }
+
+    reply->response_type = XCB_GET_INPUT_FOCUS;
+    reply->sequence = cookie.sequence;
+    reply->focus = input_focus;
+
+    return reply;
+}
+
+
+static xcb_get_keyboard_mapping_reply_t*
+get_keyboard_mapping_reply(xcb_connection_t *c, xcb_get_keyboard_mapping_cookie_t cookie,
+                           xcb_generic_error_t **e)
+{
+    xcb_window_t range = recall(cookie.sequence, e);
+    xcb_get_keyboard_mapping_reply_t *reply;
+    xcb_keysym_t *keysyms;
+    uint8_t first = range >> 8, length = range & 0xff;
+
+    (void)c;
+
+    /* The keysyms follow the reply, where xcb_get_keyboard_mapping_keysyms looks for them */
+    if (!(reply = calloc(1, sizeof(xcb_get_keyboard_mapping_reply_t) + length * sizeof(xcb_keysym_t)))) {
+        return NULL;
+    }
+
+    reply->response_type = XCB_GET_KEYBOARD_MAPPING;
+    reply->keysyms_per_keycode = 1;
+    reply->sequence = cookie.sequence;
+    reply->length = length;
+    keysyms = (xcb_keysym_t *)(reply + 1);
+
+    /* A keyboard of printable ASCII, keycode 8 is the space */
+    for (uint8_t i = 0; i < length; i++) {
+        keysyms[i] = first + i >= 8 && first + i - 8 < 0x7f - 0x20 ? 0x20 + first + i - 8 : 0;
+    }
+
+    return reply;
+}
+
+
+static xcb_get_window_attributes_reply_t*
+get_window_attributes_reply(xcb_connection_t *c, xcb_get_window_attributes_cookie_t cookie,
+                            xcb_generic_error_t **e)
+{
+    struct fake_window *fake = find_window(recall(cookie.sequence, e));
+    xcb_get_window_attributes_reply_t *reply;
+
+    (void)c;
+
+    if (!fake || !(reply = calloc(1, sizeof(xcb_get_window_attributes_reply_t)))) {
+        return NULL;
+    }
+
+    reply->response_type = XCB_GET_WINDOW_ATTRIBUTES;
+    reply->sequence = cookie.sequence;
+    reply->visual = display.screen.root_visual;
+    reply->_class = XCB_WINDOW_CLASS_INPUT_OUTPUT;
+    reply->map_state = fake->mapped ? XCB_MAP_STATE_VIEWABLE : XCB_MAP_STATE_UNMAPPED;
+    reply->override_redirect = fake->override_redirect;
+
+    return reply;
+}
+
+
+static xcb_query_tree_reply_t*
+query_tree_reply(xcb_connection_t *c, xcb_query_tree_cookie_t cookie, xcb_generic_error_t **e)
+{
+    xcb_query_tree_reply_t *reply;
+    struct fake_window **alive;
+    xcb_window_t *children;
+    uint32_t length = 0;
+
+    (void)c;
+
+    /* Only the root is ever asked for its children */
+    if (recall(cookie.sequence, e) != display.screen.root) {
+        return calloc(1, sizeof(xcb_query_tree_reply_t));
+    }
+
+    if (!(alive = malloc((windows_length + 1) * sizeof(struct fake_window *)))) {
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < windows_capacity; i++) {
+        if (windows[i].id && windows[i].alive && windows[i].parent == display.screen.root) {
+            alive[length++] = &windows[i];
+        }
+    }
+
+    /* Children are listed bottom to top, like a real server does */
+    qsort(alive, length, sizeof(struct fake_window *), compare_stacking);
+
+    /* The children follow the reply, where xcb_query_tree_children looks for them */
+    if (!(reply = calloc(1, sizeof(xcb_query_tree_reply_t) + length * sizeof(xcb_window_t)))) {
+        free(alive);
+        return NULL;
+    }
+
+    reply->response_type = XCB_QUERY_TREE;
+    reply->sequence = cookie.sequence;
+    reply->root = display.screen.root;
+    reply->children_len = length;
+    reply->length = length;
+    children = (xcb_window_t *)(reply + 1);
+
+    for (uint32_t i = 0; i < length; i++) {
+        children[i] = alive[i]->id;
+    }
+
+    free(alive);
+
+    return reply;
+}
+
+
+static int
+flush(xcb_connection_t *c)
+{
+    (void)c;
+
+    fake_counts.flushes++;
+    return 1;
+}
+
+
+static uint32_t
+generate_id(xcb_connection_t *c)
+{
+    (void)c;
+
+    if (id_step) {
+        return id_base | (id_last += id_step);
+    }
+
+    return recycled_length ? recycled[--recycled_length] : next_id++;
+}
+
+
+static xcb_generic_event_t*
+poll_for_event(xcb_connection_t *c)
+{
+    /* Events are handed to the handlers directly, nothing ever queues up */
+    (void)c;
+    return NULL;
+}
+
+
+static void
+discard_reply(xcb_connection_t *c, unsigned int sequence)
+{
+    (void)c;
+    recall(sequence, NULL);
+    fake_counts.replies--;
+}
+
+
+static int
+connection_has_error(xcb_connection_t *c)
+{
+    (void)c;
+    return 0;
+}
@@ -0,0 +1,43 @@
+#ifndef WM_FAKE_H
+#define WM_FAKE_H
+
+#include <stdbool.h>
+#include <xcb/xcb.h>
+
+#include "types.h"
+
+/* Windows the fake made up itself start here, leave the range to it */
+#define FAKE_ID_BASE 0x00200000
+
+/* Highest major opcode the fake counts requests for */
+#define FAKE_OPCODES 128
+
+/*
+ * Struct: fake_counts
+ * -------------------
+ * What the handlers asked of the fake server
+ *
+ * requests  - Requests sent in total
+ * replies   - Replies waited on
+ * flushes   - Flushes of the output buffer
+ * opcodes   - Requests sent by major opcode
+ */
+struct fake_counts {
+    uint64_t requests;
+    uint64_t replies;
+    uint64_t flushes;
+    uint64_t opcodes[FAKE_OPCODES];
+};
+
+extern const struct backend fake_backend;
+extern struct fake_counts fake_counts;
+
+xcb_screen_t* fake_deploy(uint16_t width, uint16_t height, uint8_t depth);
+void fake_replay(xcb_window_t root, uint32_t base, uint32_t mask);
+void fake_cleanup(void);
+void fake_add_window(xcb_window_t window, int16_t x, int16_t y, uint16_t width,
+                     uint16_t height, uint8_t depth, bool override_redirect);
+const char* fake_opcode_name(uint8_t opcode);
+uint32_t fake_sequence(void);
+
+#endif
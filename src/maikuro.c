@@ -1,7 +1,9 @@
 /* Maikuro - Chisai's Client */
 /* Imports */
 #include <limits.h>
+#include <poll.h>
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,9 +33,150 @@ die(char *fmt, ...)
 
 /* Variables */
 char message[BUFSIZ];
+char replies[BUFSIZ];
+size_t replies_length;
 struct sockaddr_un sock_address;
 int sock_fd;
 const char *sock_path;
+size_t sent, answered, failed;
+
+/*
+ * Function: send_all
+ * ------------------
+ * Writes the whole buffer to Chisai, however many writes it takes
+ *
+ * buffer: Bytes to send
+ * length: Number of bytes to send
+ *
+ * returns: nothing, exits if the socket fails
+ */
+static void
+send_all(const char *buffer, size_t length)
+{
+    ssize_t written;
+
+    while (length > 0) {
+        if ((written = write(sock_fd, buffer, length)) < 0) {
+            die("maikuro: failed to send message to chisai\n");
+        }
+
+        buffer += written;
+        length -= written;
+    }
+}
+
+/*
+ * Function: read_replies
+ * ----------------------
+ * Reads the statuses Chisai sends back, one line per command, and
+ * reports the commands that failed. Lines starting with "> " are output
+ * of the command and get printed
+ *
+ * returns: false once Chisai closed the connection
+ */
+static bool
+read_replies(void)
+{
+    ssize_t length;
+    size_t start = 0;
+
+    length = read(sock_fd, replies + replies_length, sizeof(replies) - replies_length);
+
+    if (length <= 0) {
+        return false;
+    }
+
+    for (size_t i = replies_length; i < replies_length + (size_t)length; i++) {
+        if (replies[i] != '\n') {
+            continue;
+        }
+
+        replies[i] = '\0';
+
+        /* Output of a command comes before its status */
+        if (!strncmp(replies + start, "> ", 2)) {
+            puts(replies + start + 2);
+            start = i + 1;
+            continue;
+        }
+
+        answered++;
+
+        if (strcmp(replies + start, "ok")) {
+            fprintf(stderr, "maikuro: command %zu: %s\n", answered, replies + start);
+            failed++;
+        }
+
+        start = i + 1;
+    }
+
+    replies_length += length - start;
+    memmove(replies, replies + start, replies_length);
+
+    /* Replies are short, anything this long isn't one */
+    if (replies_length == sizeof(replies)) {
+        replies_length = 0;
+    }
+
+    return true;
+}
+
+/*
+ * Function: batch
+ * ---------------
+ * Streams newline separated commands from stdin over the one connection
+ * while collecting their statuses
+ *
+ * returns: nothing, every command has been answered or Chisai hung up
+ */
+static void
+batch(void)
+{
+    struct pollfd fds[2] = {
+        { .fd = STDIN_FILENO, .events = POLLIN },
+        { .fd = sock_fd, .events = POLLIN },
+    };
+    bool in_line = false;
+    ssize_t length;
+
+    while (fds[0].fd >= 0 || answered < sent) {
+        if (poll(fds, 2, -1) < 0) {
+            die("maikuro: failed to wait for input\n");
+        }
+
+        if (fds[1].revents && !read_replies()) {
+            return;
+        }
+
+        if (fds[0].fd < 0 || !fds[0].revents) {
+            continue;
+        }
+
+        if ((length = read(STDIN_FILENO, message, sizeof(message))) <= 0) {
+            /* Terminate a last line that has no newline */
+            if (in_line) {
+                send_all("\n", 1);
+                sent++;
+            }
+
+            shutdown(sock_fd, SHUT_WR);
+            fds[0].fd = -1;
+            continue;
+        }
+
+        /* Chisai answers every line that isn't empty */
+        for (ssize_t i = 0; i < length; i++) {
+            if (message[i] == '\n') {
+                sent += in_line;
+                in_line = false;
+            } else {
+                in_line = true;
+            }
+        }
+
+        send_all(message, length);
+    }
+}
 
 /*
  * Function: main
@@ -41,9 +184,9 @@ const char *sock_path;
  * Main loop of the client, passes messages to Chisai
  *
  * argc: number of arguments
- * argv: the arguments
+ * argv: the arguments, or - to read one command per line from stdin
  * 
- * returns: error if something goes wrong, else messages
+ * returns: error if something goes wrong or a command failed, else messages
  * just get passed into Chisai
  */
 int 
@@ -74,17 +217,30 @@ main(int argc, char* argv[])
     if (connect(sock_fd, (struct sockaddr*)&sock_address, sizeof(sock_address)) < 0)  {
         die("%s: failed to connect to socket\n", argv[0]);
     }    
- 
-    /* Concatenate arguments into one string */
-    strcpy(message, argv[1]);
-    for (int i = 2; i < argc; i++)
-    {
-        strcat(message, " ");
-        strcat(message, argv[i]);
+
+    if (!strcmp(argv[1], "-")) {
+        batch();
+    } else {
+        /* Concatenate arguments into one newline terminated string */
+        strcpy(message, argv[1]);
+        for (int i = 2; i < argc; i++)
+        {
+            strcat(message, " ");
+            strcat(message, argv[i]);
+        }
+        strcat(message, "\n");
+
+        /* Send only the message, Chisai splits messages on newlines */
+        send_all(message, strlen(message));
+        shutdown(sock_fd, SHUT_WR);
+        sent = 1;
+
+        while (answered < sent && read_replies());
     }
-    
-    /* Send message to Chisai */
-    if (write(sock_fd, message, sizeof(message)) < 0) {
-        die("%s: failed to send message to chisai\n", argv[0]);
+
+    if (answered < sent) {
+        die("%s: chisai hung up before answering\n", argv[0]);
     }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
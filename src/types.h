@@ -2,8 +2,18 @@
 #define WM_TYPES_H
 
 #include <stdbool.h>
+#include <stdio.h>
 #include <xcb/randr.h>
 
+/*
+ * Slot of a window in a hash table of capacity slots, a power of two. It is
+ * the high half of a 64 bit Fibonacci product, the low bits of a product
+ * only depend on the low bits of the id, which the first windows of every X
+ * client share
+ */
+#define WINDOW_HASH(window, capacity) \
+    ((uint32_t)(((uint64_t)(window) * 0x9e3779b97f4a7c15u) >> 32) & ((capacity) - 1))
+
 /* 
  * Enum : position
  * ---------------
@@ -45,6 +55,10 @@ struct sizepos {
  * unfocus_color  - Border color of the unfocued windows
  * workspaces     - Number of workspaces 
  * sloppy_fous    - Whether or not sloppy focus is enabled
+ * focus_delay    - Milliseconds sloppy focus waits for the pointer to settle
+ * refresh_rate   - Configures per second sent while dragging
+ * stats          - Whether events and commands are timed
+ * trace          - Whether events and commands are recorded in the trace
  */
 struct conf {
     enum position border_side;
@@ -52,6 +66,187 @@ struct conf {
     uint32_t focus_color, unfocus_color;
     uint32_t workspaces;
     bool sloppy_focus;
+    uint32_t focus_delay;
+    uint32_t refresh_rate;
+    bool stats;
+    bool trace;
+};
+
+
+/*
+ * Struct: insets
+ * --------------
+ * Where a client sits in its frame, worked out once per border side and width
+ *
+ * x, y           - Position of the client in the frame
+ * width, height  - How much bigger the frame is than the client
+ */
+struct insets {
+    int16_t x, y;
+    uint16_t width, height;
+};
+
+
+/*
+ * Struct: frame_visual
+ * --------------------
+ * What frames of one depth are created with, looked up the first time it is needed
+ *
+ * visual    - Visual of the depth, 0 until looked up
+ * colormap  - Colormap for the visual, the default one at the root depth
+ */
+struct frame_visual {
+    xcb_visualid_t visual;
+    xcb_colormap_t colormap;
+};
+
+
+/*
+ * Struct: histogram
+ * -----------------
+ * How long one kind of event or command took to handle
+ *
+ * count    - Number of times it was handled
+ * total    - Nanoseconds spent on it in total
+ * max      - Slowest time in nanoseconds
+ * buckets  - Counts by power of two, bucket n holds times under 2^n ns
+ */
+struct histogram {
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+    uint32_t buckets[32];
+};
+
+
+/*
+ * Struct: traffic
+ * ---------------
+ * X protocol cost of one kind of event or command
+ *
+ * requests  - Requests sent
+ * replies   - Replies waited on
+ * waited    - Nanoseconds spent waiting on replies, only while stats are on
+ * flushes   - Flushes of the output buffer
+ */
+struct traffic {
+    uint64_t requests;
+    uint64_t replies;
+    uint64_t waited;
+    uint64_t flushes;
+};
+
+
+/*
+ * Struct: trace_event
+ * -------------------
+ * Entry of the trace ring buffer
+ *
+ * start     - Monotonic time it started at in nanoseconds
+ * duration  - How long it took in nanoseconds
+ * slot      - X event type or STAT_ slot of what happened
+ * requests  - Requests a flush sent out, 0 for everything else
+ */
+struct trace_event {
+    uint64_t start;
+    uint32_t duration;
+    uint16_t slot;
+    uint16_t requests;
+};
+
+
+/*
+ * Struct: drag
+ * ------------
+ * State of a move or resize done with the mouse
+ *
+ * client   - The client being dragged, NULL when there is no drag
+ * button   - 1 to move, 3 to resize
+ * root_x   - Latest pointer X coordinate seen
+ * root_y   - Latest pointer Y coordinate seen
+ * pending  - Whether the pointer moved since the last configure
+ * moved    - Whether the move put the frame anywhere else
+ * paced    - Whether the frame timer is running
+ */
+struct drag {
+    struct client *client;
+    uint8_t button;
+    int16_t root_x, root_y;
+    bool pending;
+    bool moved;
+    bool paced;
+};
+
+
+/*
+ * Enum : value_type
+ * -----------------
+ * The kinds of argument a command can take
+ */
+enum value_type {
+    VALUE_NONE,
+    VALUE_INT,
+    VALUE_BOOL,
+    VALUE_SIDE,
+    VALUE_COLOR,
+    VALUE_STRING,
+};
+
+
+/*
+ * Union: value
+ * ------------
+ * Argument of a command after it has been parsed and validated
+ *
+ * i     - VALUE_INT argument
+ * b     - VALUE_BOOL argument
+ * side  - VALUE_SIDE argument
+ * color - VALUE_COLOR argument, as a pixel
+ * s     - VALUE_STRING argument, only valid while the command runs
+ */
+union value {
+    int32_t i;
+    bool b;
+    enum position side;
+    uint32_t color;
+    const char *s;
+};
+
+
+/*
+ * Struct: command
+ * ---------------
+ * Entry of the command table the socket dispatches with
+ *
+ * name    - Words that make up the command, like "config border_width"
+ * type    - Type of the one argument the command takes, if any
+ * min     - Smallest accepted VALUE_INT argument
+ * max     - Largest accepted VALUE_INT argument
+ * action  - Called for commands without an argument
+ * set     - Called with the parsed argument otherwise, returns an error or NULL
+ */
+struct command {
+    const char *name;
+    enum value_type type;
+    int32_t min, max;
+    void (*action)(void);
+    const char* (*set)(const union value *value);
+};
+
+
+/*
+ * Struct: key
+ * -----------
+ * Key binding, pressing it runs a command like one sent to the socket
+ *
+ * modifiers  - Modifiers that have to be held, lock keys don't matter
+ * keysym     - Key that has to be pressed, plain characters are their own keysym
+ * command    - Command to run, like "workspace 1"
+ */
+struct key {
+    uint16_t modifiers;
+    xcb_keysym_t keysym;
+    const char *command;
 };
 
 
@@ -75,44 +270,312 @@ struct Arg {
  * Client wrapper for windows 
  *
  * window         - The window
+ * frame          - Window the client is reparented into, the border is its background
  * maxed          - Whether or not the window is maxed
+ * workspace      - Workspace the client is on, 0 until it has one
+ * index          - Position of the client in its workspace
+ * hidden         - Whether the frame is unmapped because its workspace isn't shown
+ * x, y           - Position the frame has, or will have once our requests land
+ * width, height  - Size of the client, likewise
+ * inner_x, inner_y - Position of the client in the frame, likewise
+ * outer_width, outer_height - Size of the frame, likewise
+ * border_width   - Border width of the client, likewise, BORDER_UNKNOWN until it is known
+ * border         - Color last set as the frame background
+ * frame_sequence - Sequence of our last configure of the frame
+ * frame_pending  - Fields of the frame our configures may not have set yet, older ConfigureNotify don't touch them
+ * window_sequence - Sequence of our last configure of the client, likewise
+ * window_pending - Fields of the client our configures may not have set yet, likewise
+ * depth          - Depth of the frame
+ * depth_cookie   - Pending request for the depth of the client, sequence 0 once it is in
  * original_size  - Save the size for maxed windows
+ * below          - Client right under this one in the stacking order
+ * above          - Client right over this one in the stacking order
+ * restack        - Whether the client was raised since the last flush
+ * previous       - Previous client in creation order
+ * next           - Next client in creation order, or in the free list of the pool
+ *
+ * Clients are aligned to a cache line so no two share one.
  */ 
 struct client {
-    xcb_window_t window;
+    _Alignas(64) xcb_window_t window;
+    xcb_window_t frame;
     uint16_t workspace;
+    uint32_t index;
+    bool hidden;
     bool maxed;
     bool mapped;
     int16_t x, y;
     uint16_t width, height;
+    int16_t inner_x, inner_y;
+    uint16_t outer_width, outer_height;
+    uint16_t border_width;
+    uint32_t border;
+    uint32_t frame_sequence, window_sequence;
+    uint16_t frame_pending, window_pending;
     uint8_t depth;
+    xcb_get_geometry_cookie_t depth_cookie;
     struct sizepos original_size;
+    struct client *below, *above;
+    bool restack;
+    struct client *previous, *next;
 };
 
 /*
- * Struct: node
- * ------------
- * node in the list 
+ * Struct: client_slab
+ * -------------------
+ * Block of clients the pool hands out one by one
  *
- * data  - Actual data of the element
- * next  - Next node in the list
+ * next     - Slab allocated before this one
+ * clients  - The clients
  */
-struct node {
-    void *data;
-    struct node *next;
+struct client_slab {
+    struct client_slab *next;
+    struct client clients[64];
 };
 
-/* 
- * Struct: list
+/*
+ * Struct: client_pool
+ * -------------------
+ * Allocator for clients, freed clients are kept for reuse and slabs only go
+ * away when chisai exits
+ *
+ * slabs  - Every slab, newest first
+ * free   - Clients ready to be handed out, linked through next
+ * live   - Clients handed out
+ * peak   - Most clients ever handed out at once
+ * count  - Number of slabs
+ */
+struct client_pool {
+    struct client_slab *slabs;
+    struct client *free;
+    uint32_t live, peak;
+    uint32_t count;
+};
+
+/*
+ * Struct: workspace
+ * -----------------
+ * Dense array of the clients on a workspace
+ *
+ * clients   - The clients, in no particular order
+ * length    - Number of clients
+ * capacity  - Number of clients there is room for
+ * focused   - Client that had the focus when the workspace was left
+ */
+struct workspace {
+    struct client **clients;
+    uint32_t length, capacity;
+    struct client *focused;
+};
+
+/*
+ * Struct: table
+ * -------------
+ * Open addressing hash table keyed on windows. The slots are stored inline and
+ * can be any struct, the window keying one sits key bytes into it
+ *
+ * capacity  - Number of slots, always a power of two
+ * length    - Number of slots in use
+ * size      - Size of a slot
+ * key       - Offset of the window in a slot, XCB_NONE there marks it empty
+ * slots     - The slots
+ */
+struct table {
+    uint32_t capacity;
+    uint32_t length;
+    size_t size, key;
+    void *slots;
+};
+
+/*
+ * Struct: client_slot
+ * -------------------
+ * Slot of the client table, the key is kept inline so probes don't chase the client
+ *
+ * window  - The client window or its frame, XCB_NONE for an empty slot
+ * client  - Client the window belongs to
+ */
+struct client_slot {
+    xcb_window_t window;
+    struct client *client;
+};
+
+/*
+ * Struct: client_table
+ * --------------------
+ * Table from window to client, owns the clients. A framed client is in it
+ * twice, under its window and under its frame
+ *
+ * table     - Table of client_slot
+ * head      - Oldest client, for iterating in creation order
+ * tail      - Newest client
+ */
+struct client_table {
+    struct table table;
+    struct client *head, *tail;
+};
+
+/*
+ * Struct: unmanaged
+ * -----------------
+ * Override-redirect window, like a menu or tooltip, that chisai leaves alone.
+ * These are kept in a table of their own so they cost no allocation and never
+ * slow down looking clients up
+ *
+ * window  - The window, XCB_NONE for an empty slot
+ * x, y    - Position, from CreateNotify and ConfigureNotify
+ * width   - Width
+ * height  - Height
+ */
+struct unmanaged {
+    xcb_window_t window;
+    int16_t x, y;
+    uint16_t width, height;
+};
+
+/*
+ * Struct: peer
  * ------------
- * Singely linked list
+ * Connection to a client of the socket, like maikuro
+ *
+ * fd       - Socket of the connection
+ * length   - Bytes waiting in the buffer
+ * buffer   - Bytes received that don't make a whole message yet
+ * pending  - Bytes waiting in the output
+ * output   - Replies the socket didn't take yet
+ * closing  - Whether the peer hung up and only the output is left
+ * writing  - Whether epoll is watching for room to write the output
+ */
+struct peer {
+    int fd;
+    size_t length;
+    char buffer[BUFSIZ];
+    size_t pending;
+    char output[2 * BUFSIZ];
+    bool closing;
+    bool writing;
+};
+
+
+/*
+ * Struct: record_setup
+ * --------------------
+ * What a replay needs of the recorded connection, first in every recording
  *
- * length  - length of the list
- * head    - first node in the list 
+ * root           - Root window
+ * id_base        - Resource id base of the connection
+ * id_mask        - Resource id mask of the connection
+ * width, height  - Size of the screen
+ * depth          - Depth of the root window
  */
-struct list {
-    int length;
-    struct node *head;
+struct record_setup {
+    xcb_window_t root;
+    uint32_t id_base, id_mask;
+    uint16_t width, height;
+    uint8_t depth;
+};
+
+
+/*
+ * Struct: record_keymap
+ * ---------------------
+ * Keyboard mapping key presses were resolved with
+ *
+ * min_keycode, max_keycode - Keycodes the server uses
+ * keysyms                  - Unshifted keysym of every keycode
+ */
+struct record_keymap {
+    xcb_keycode_t min_keycode, max_keycode;
+    xcb_keysym_t keysyms[256];
+};
+
+
+/*
+ * Struct: record_adopt
+ * --------------------
+ * Window that was already there at startup, as adopt_windows() saw it
+ *
+ * window             - The window
+ * x, y               - Position
+ * width, height      - Size
+ * border_width       - Width of the border
+ * depth              - Depth
+ * override_redirect  - Whether the window asked not to be managed
+ * input_only         - Whether the window is InputOnly
+ * viewable           - Whether the window was viewable
+ */
+struct record_adopt {
+    xcb_window_t window;
+    int16_t x, y;
+    uint16_t width, height;
+    uint16_t border_width;
+    uint8_t depth;
+    bool override_redirect;
+    bool input_only;
+    bool viewable;
+};
+
+
+/*
+ * Struct: record_depth
+ * --------------------
+ * Depth a new client turned out to have, when it needed a frame of its own
+ *
+ * window  - The client
+ * depth   - Its depth
+ */
+struct record_depth {
+    xcb_window_t window;
+    uint8_t depth;
+};
+
+
+/*
+ * Struct: backend
+ * ---------------
+ * The xcb calls chisai makes, so handlers can run against the fake in fake.c
+ * instead of a server. Every member takes the same arguments as the xcb call
+ * it is named after.
+ */
+struct backend {
+    xcb_void_cookie_t (*change_save_set)(xcb_connection_t *c, uint8_t mode, xcb_window_t window);
+    xcb_void_cookie_t (*change_window_attributes)(xcb_connection_t *c, xcb_window_t window, uint32_t mask, const void *values);
+    xcb_void_cookie_t (*change_window_attributes_checked)(xcb_connection_t *c, xcb_window_t window, uint32_t mask, const void *values);
+    xcb_void_cookie_t (*clear_area)(xcb_connection_t *c, uint8_t exposures, xcb_window_t window, int16_t x, int16_t y, uint16_t width, uint16_t height);
+    xcb_void_cookie_t (*configure_window)(xcb_connection_t *c, xcb_window_t window, uint16_t mask, const void *values);
+    xcb_void_cookie_t (*create_colormap)(xcb_connection_t *c, uint8_t alloc, xcb_colormap_t mid, xcb_window_t window, xcb_visualid_t visual);
+    xcb_void_cookie_t (*create_window)(xcb_connection_t *c, uint8_t depth, xcb_window_t wid, xcb_window_t parent, int16_t x, int16_t y, uint16_t width, uint16_t height, uint16_t border_width, uint16_t _class, xcb_visualid_t visual, uint32_t value_mask, const void *value_list);
+    xcb_void_cookie_t (*destroy_window)(xcb_connection_t *c, xcb_window_t window);
+    xcb_get_geometry_cookie_t (*get_geometry)(xcb_connection_t *c, xcb_drawable_t drawable);
+    xcb_get_input_focus_cookie_t (*get_input_focus)(xcb_connection_t *c);
+    xcb_get_keyboard_mapping_cookie_t (*get_keyboard_mapping)(xcb_connection_t *c, xcb_keycode_t first_keycode, uint8_t count);
+    xcb_get_window_attributes_cookie_t (*get_window_attributes)(xcb_connection_t *c, xcb_window_t window);
+    xcb_void_cookie_t (*grab_button)(xcb_connection_t *c, uint8_t owner_events, xcb_window_t window, uint16_t event_mask, uint8_t pointer_mode, uint8_t keyboard_mode, xcb_window_t confine_to, xcb_cursor_t cursor, uint8_t button, uint16_t modifiers);
+    xcb_void_cookie_t (*grab_key)(xcb_connection_t *c, uint8_t owner_events, xcb_window_t window, uint16_t modifiers, xcb_keycode_t key, uint8_t pointer_mode, uint8_t keyboard_mode);
+    xcb_grab_pointer_cookie_t (*grab_pointer)(xcb_connection_t *c, uint8_t owner_events, xcb_window_t window, uint16_t event_mask, uint8_t pointer_mode, uint8_t keyboard_mode, xcb_window_t confine_to, xcb_cursor_t cursor, xcb_timestamp_t time);
+    xcb_void_cookie_t (*kill_client)(xcb_connection_t *c, uint32_t resource);
+    xcb_void_cookie_t (*map_window)(xcb_connection_t *c, xcb_window_t window);
+    xcb_query_tree_cookie_t (*query_tree)(xcb_connection_t *c, xcb_window_t window);
+    xcb_void_cookie_t (*reparent_window)(xcb_connection_t *c, xcb_window_t window, xcb_window_t parent, int16_t x, int16_t y);
+    xcb_void_cookie_t (*send_event)(xcb_connection_t *c, uint8_t propagate, xcb_window_t destination, uint32_t event_mask, const char *event);
+    xcb_void_cookie_t (*set_input_focus)(xcb_connection_t *c, uint8_t revert_to, xcb_window_t focus, xcb_timestamp_t time);
+    xcb_void_cookie_t (*ungrab_key)(xcb_connection_t *c, xcb_keycode_t key, xcb_window_t window, uint16_t modifiers);
+    xcb_void_cookie_t (*ungrab_pointer)(xcb_connection_t *c, xcb_timestamp_t time);
+    xcb_void_cookie_t (*unmap_window)(xcb_connection_t *c, xcb_window_t window);
+    xcb_void_cookie_t (*warp_pointer)(xcb_connection_t *c, xcb_window_t src_window, xcb_window_t dst_window, int16_t src_x, int16_t src_y, uint16_t src_width, uint16_t src_height, int16_t dst_x, int16_t dst_y);
+
+    xcb_get_geometry_reply_t* (*get_geometry_reply)(xcb_connection_t *c, xcb_get_geometry_cookie_t cookie, xcb_generic_error_t **e);
+    xcb_get_input_focus_reply_t* (*get_input_focus_reply)(xcb_connection_t *c, xcb_get_input_focus_cookie_t cookie, xcb_generic_error_t **e);
+    xcb_get_keyboard_mapping_reply_t* (*get_keyboard_mapping_reply)(xcb_connection_t *c, xcb_get_keyboard_mapping_cookie_t cookie, xcb_generic_error_t **e);
+    xcb_get_window_attributes_reply_t* (*get_window_attributes_reply)(xcb_connection_t *c, xcb_get_window_attributes_cookie_t cookie, xcb_generic_error_t **e);
+    xcb_query_tree_reply_t* (*query_tree_reply)(xcb_connection_t *c, xcb_query_tree_cookie_t cookie, xcb_generic_error_t **e);
+
+    int (*flush)(xcb_connection_t *c);
+    uint32_t (*generate_id)(xcb_connection_t *c);
+    xcb_generic_event_t* (*poll_for_event)(xcb_connection_t *c);
+    xcb_generic_event_t* (*poll_for_queued_event)(xcb_connection_t *c);
+    void (*discard_reply)(xcb_connection_t *c, unsigned int sequence);
+    int (*connection_has_error)(xcb_connection_t *c);
 };
 
 